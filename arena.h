@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* ###############################
+   #        ARENA                #
+   ###############################
+*/
+
+/*
+   Bump allocator that owns every AST node and symbol of one program. Objects are
+   laid out in parse order and all of them are released together when the arena
+   is dropped, running the destructors of the ones that need it.
+*/
+class Arena
+{
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    struct Finalizer
+    {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    Chunk* chunks;
+    Finalizer* finalizers;
+    char* cursor;
+    char* limit;
+    size_t chunk_size;
+    size_t bytes_used;
+
+    void grow(size_t min_size)
+    {
+        size_t size = chunk_size;
+        if (min_size + sizeof(Chunk) > size)
+            size = min_size + sizeof(Chunk);
+
+        Chunk* chunk = static_cast<Chunk*>(malloc(size));
+        if (chunk == NULL)
+            throw std::bad_alloc();
+        chunk->next = chunks;
+        chunks = chunk;
+        cursor = reinterpret_cast<char*>(chunk + 1);
+        limit = reinterpret_cast<char*>(chunk) + size;
+    }
+
+    template <class T>
+    static void destroy(void* object)
+    {
+        static_cast<T*>(object)->~T();
+    }
+
+public:
+    Arena(size_t chunk_size = 64 * 1024)
+    {
+        this->chunks = NULL;
+        this->finalizers = NULL;
+        this->cursor = NULL;
+        this->limit = NULL;
+        this->chunk_size = chunk_size;
+        this->bytes_used = 0;
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        release();
+    }
+
+    void* allocate(size_t size, size_t alignment)
+    {
+        uintptr_t address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (cursor == NULL || address + size > reinterpret_cast<uintptr_t>(limit))
+        {
+            grow(size + alignment);
+            address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        }
+
+        cursor = reinterpret_cast<char*>(address + size);
+        bytes_used += size;
+        return reinterpret_cast<void*>(address);
+    }
+
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            Finalizer* finalizer = new (allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer;
+            finalizer->destroy = &Arena::destroy<T>;
+            finalizer->object = object;
+            finalizer->next = finalizers;
+            finalizers = finalizer;
+        }
+        return object;
+    }
+
+    //Destroys every object (newest first) and frees all memory in one go
+    void release()
+    {
+        for (Finalizer* finalizer = finalizers; finalizer != NULL; finalizer = finalizer->next)
+            finalizer->destroy(finalizer->object);
+        finalizers = NULL;
+
+        while (chunks != NULL)
+        {
+            Chunk* next = chunks->next;
+            free(chunks);
+            chunks = next;
+        }
+        cursor = NULL;
+        limit = NULL;
+        bytes_used = 0;
+    }
+
+    size_t size()
+    {
+        return bytes_used;
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+#include "runner.h"
+#include <filesystem>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+
+/* ###############################
+   #        BATCH                #
+   ###############################
+*/
+
+/*
+   Runs a fixed set of tasks on a number of threads. Tasks are dealt out to the workers
+   in turn; a worker takes its own from the front of its queue and, once that is empty,
+   steals from the back of the others', so one long program does not hold up the ones
+   queued behind it. All tasks are submitted before run() and none submits more, so a
+   worker is done when every queue is empty.
+*/
+class ThreadPool
+{
+    struct Worker
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    int next;
+
+public:
+    ThreadPool(int threads)
+    {
+        for (int i = 0; i < max(1, threads); i++)
+            this->workers.emplace_back(new Worker());
+        this->next = 0;
+    }
+
+    void submit(function<void()> task)
+    {
+        workers[next]->tasks.push_back(move(task));
+        next = (next + 1) % workers.size();
+    }
+
+    //Runs every submitted task and returns when they have all finished
+    void run()
+    {
+        vector<thread> threads;
+        for (int i = 1; i < (int)workers.size(); i++)
+            threads.emplace_back([this, i]() { work(i); });
+        work(0);
+        for (thread& t : threads)
+            t.join();
+    }
+
+private:
+    void work(int self)
+    {
+        function<void()> task;
+        while (take(self, task))
+            task();
+    }
+
+    bool take(int self, function<void()>& task)
+    {
+        {
+            lock_guard<mutex> guard(workers[self]->lock);
+            if (!workers[self]->tasks.empty())
+            {
+                task = move(workers[self]->tasks.front());
+                workers[self]->tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers.size(); i++)
+        {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = move(victim.tasks.back());
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+//What one program of a batch printed, kept until every program before it has been printed
+struct BatchResult
+{
+    string output;
+    bool failed;
+    bool done;
+};
+
+/*
+   The programs a batch runs, in the order they are reported: a directory stands for the
+   files in it sorted by name (leaving out the .in files that hold READ input), @FILE for
+   the paths listed in FILE one per line, anything else for itself.
+*/
+vector<string> batch_programs(const vector<string>& arguments)
+{
+    vector<string> programs;
+    for (const string& argument : arguments)
+    {
+        if (argument.size() > 1 && argument[0] == '@')
+        {
+            ifstream list(argument.substr(1));
+            if (!list)
+                fail("Could not open the program list '" + argument.substr(1) + "'");
+            string line;
+            while (getline(list, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (!line.empty())
+                    programs.push_back(line);
+            }
+        }
+        else if (filesystem::is_directory(argument))
+        {
+            vector<string> files;
+            for (const filesystem::directory_entry& entry : filesystem::directory_iterator(argument))
+            {
+                if (entry.is_regular_file() && entry.path().extension() != ".in")
+                    files.push_back(entry.path().string());
+            }
+            sort(files.begin(), files.end());
+            programs.insert(programs.end(), files.begin(), files.end());
+        }
+        else
+            programs.push_back(argument);
+    }
+    return programs;
+}
+
+//Runs one program of a batch, with its READ input from 'program.in' when there is such a file
+BatchResult run_batch_program(const string& file_name, const RunOptions& options)
+{
+    BatchResult result = { "", false, false };
+    string input_name = file_name + ".in";
+#ifdef _WIN32
+    int input = _open(input_name.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int input = open(input_name.c_str(), O_RDONLY);
+#endif
+
+    stringbuf buffer;
+    {
+        RunContext context(&buffer, input);
+        ostream report(&buffer);
+        try
+        {
+            run_file(file_name, options, context, report);
+        }
+        catch (exception& error)
+        {
+            context.output.write_line(string("ERROR:: ") + error.what());
+            result.failed = true;
+        }
+    }
+    if (input >= 0)
+        close(input);
+    result.output = buffer.str();
+    return result;
+}
+
+/*
+   --batch runs many programs at once, 'jobs' at a time, each with a context of its own.
+   Every program's output is collected separately and printed under a "==> file <=="
+   header in the order the programs were given, as soon as it and all before it are
+   done, so the output does not depend on how the programs were scheduled. An error ends
+   only the program it happens in; the status is 10 if any program failed.
+*/
+int run_batch(const vector<string>& arguments, const RunOptions& options, int jobs)
+{
+    vector<string> programs = batch_programs(arguments);
+    vector<BatchResult> results(programs.size(), { "", false, false });
+    mutex print_lock;
+    size_t printed = 0;
+    int failures = 0;
+    auto start = chrono::steady_clock::now();
+
+    int threads = min<int>(jobs, max<size_t>(1, programs.size()));
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        pool.submit([&, i]() {
+            BatchResult result = run_batch_program(programs[i], options);
+            lock_guard<mutex> guard(print_lock);
+            results[i] = move(result);
+            results[i].done = true;
+            for (; printed < results.size() && results[printed].done; printed++)
+            {
+                cout << "==> " << programs[printed] << " <==" << '\n' << results[printed].output;
+                failures += results[printed].failed;
+                string().swap(results[printed].output);
+            }
+            cout.flush();
+        });
+    }
+    pool.run();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << programs.size() << " programs, " << failures << " failed, " << seconds << " s on " << threads << " threads" << endl;
+    return failures > 0 ? 10 : 0;
+}
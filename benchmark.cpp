@@ -0,0 +1,411 @@
+#include "closure.h"
+#include "optimizer.h"
+#include <chrono>
+#include <cstdio>
+
+/* ###############################
+   #        BENCHMARKS           #
+   ###############################
+*/
+
+/*
+   Built next to main.cpp as its own executable. Every benchmark generates its program
+   in memory, runs it --repetitions times and prints the best and median time and a
+   throughput figure as JSON on stdout, so runs can be compared with each other.
+
+   Micro benchmarks time one stage of the pipeline on its own: the lexer, the parser,
+   the SemanticAnalyzer and the tree interpreter. Macro benchmarks run a whole program
+   (parse, analysis, optimization and execution) on every engine. PRINT output goes to
+   a sink that buffers like cout but never writes, READ input comes from a temporary
+   file; each run gets a fresh RunContext over the two.
+*/
+
+//Stands in for stdout while benchmarks run, PRINT fills and drains it like a real buffer
+class NullOutput : public streambuf
+{
+    char buffer[OUTPUT_BUFFER_SIZE];
+
+public:
+    NullOutput()
+    {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+protected:
+    int overflow(int c) override
+    {
+        setp(buffer, buffer + sizeof(buffer));
+        if (c != EOF)
+            sputc(c);
+        return 0;
+    }
+};
+
+struct BenchmarkResult
+{
+    string name;
+    int repetitions;
+    double best_seconds;
+    double median_seconds;
+    double work;        //units of work done by one repetition
+    string unit;        //what the rate counts, per second
+};
+
+class BenchmarkRunner
+{
+    string filter;
+    int repetitions;
+    double scale;
+    vector<BenchmarkResult> results;
+
+public:
+    BenchmarkRunner(string filter, int repetitions, double scale)
+    {
+        this->filter = filter;
+        this->repetitions = repetitions;
+        this->scale = scale;
+    }
+
+    int scaled(int count)
+    {
+        return max(1, int(count * scale));
+    }
+
+    //'run' does one repetition and returns the seconds of the part being measured
+    void measure(string name, double work, string unit, function<double()> run)
+    {
+        if (name.find(filter) == string::npos)
+            return;
+
+        vector<double> samples;
+        for (int i = 0; i < repetitions; i++)
+            samples.push_back(run());
+        sort(samples.begin(), samples.end());
+        results.push_back({ name, repetitions, samples[0], samples[samples.size() / 2], work, unit });
+    }
+
+    void print_json(ostream& out)
+    {
+        out << "{" << endl;
+        out << "  \"context\": { \"repetitions\": " << repetitions << ", \"scale\": " << scale << " }," << endl;
+        out << "  \"benchmarks\": [" << endl;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            BenchmarkResult& result = results[i];
+            out << "    { \"name\": \"" << result.name << "\""
+                << ", \"repetitions\": " << result.repetitions
+                << ", \"best_seconds\": " << result.best_seconds
+                << ", \"median_seconds\": " << result.median_seconds
+                << ", \"work\": " << result.work
+                << ", \"unit\": \"" << result.unit << "\""
+                << ", \"rate\": " << result.work / result.best_seconds
+                << " }" << (i + 1 < results.size() ? "," : "") << endl;
+        }
+        out << "  ]" << endl;
+        out << "}" << endl;
+    }
+};
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* ###############################
+   #        WORKLOADS            #
+   ###############################
+*/
+
+//Many procedures with every kind of statement, comments and strings, to lex, parse and analyze
+string declarations_program(int procedures)
+{
+    string text = "PROGRAM Corpus;\nVAR total, count: INTEGER;\n    ratio: REAL;\n";
+    for (int i = 0; i < procedures; i++)
+    {
+        string name = "Step" + to_string(i);
+        text += "PROCEDURE " + name + "(n: INTEGER; scale: REAL);\n";
+        text += "VAR k, m: INTEGER;\n    r: REAL;\n";
+        text += "BEGIN { step " + to_string(i) + " of the corpus }\n";
+        text += "   k := n * " + to_string(i % 97 + 1) + " + (total DIV 3) - count;\n";
+        text += "   m := k;\n";
+        text += "   r := scale / 2.5 + ratio * 1.5;\n";
+        text += "   WHILE (k):\n";
+        text += "      k := k - 1;\n";
+        text += "      IF (k - m): m := m + 2 ^ 3 ELSE: total := total + m ENDIF;\n";
+        text += "   ENDWHILE;\n";
+        text += "   PRINT \"step done\" << k << r;\n";
+        text += "END;\n";
+    }
+    text += "BEGIN\n   total := 0;\n   count := 0;\n   ratio := 0.5;\n";
+    for (int i = 0; i < procedures; i++)
+        text += "   Step" + to_string(i) + "(" + to_string(i % 5) + ", 1.5);\n";
+    text += "END.\n";
+    return text;
+}
+
+string arithmetic_program(int iterations)
+{
+    return "PROGRAM Arithmetic;\n"
+        "VAR i, a, b: INTEGER;\n"
+        "    x, y: REAL;\n"
+        "BEGIN\n"
+        "   i := " + to_string(iterations) + ";\n"
+        "   a := 0; b := 1; x := 0.0; y := 1.5;\n"
+        "   WHILE (i):\n"
+        "      a := (a + i * 3) DIV 2;\n"
+        "      b := a * 3 - b DIV 2;\n"
+        "      x := x + y * 0.5 - x / 4.0;\n"
+        "      i := i - 1;\n"
+        "   ENDWHILE;\n"
+        "   PRINT a << b << x;\n"
+        "END.\n";
+}
+
+//Runs calls + (calls / 100) * 101 procedure calls, half of them 100 deep
+string call_program(int calls)
+{
+    return "PROGRAM Calls;\n"
+        "VAR i, s: INTEGER;\n"
+        "PROCEDURE Add(d: INTEGER; e: INTEGER);\n"
+        "VAR t: INTEGER;\n"
+        "BEGIN\n"
+        "   t := d + e;\n"
+        "   s := s + t DIV 1000\n"
+        "END;\n"
+        "PROCEDURE Down(n: INTEGER);\n"
+        "BEGIN\n"
+        "   IF (n): Down(n - 1); s := s + 1 ENDIF\n"
+        "END;\n"
+        "BEGIN\n"
+        "   i := " + to_string(calls) + "; s := 0;\n"
+        "   WHILE (i): Add(i, 1); i := i - 1 ENDWHILE;\n"
+        "   i := " + to_string(calls / 100) + ";\n"
+        "   WHILE (i): Down(100); i := i - 1 ENDWHILE;\n"
+        "   PRINT s\n"
+        "END.\n";
+}
+
+string print_program(int lines)
+{
+    return "PROGRAM Printer;\n"
+        "VAR i: INTEGER;\n"
+        "    x: REAL;\n"
+        "BEGIN\n"
+        "   i := " + to_string(lines) + "; x := 0.25;\n"
+        "   WHILE (i):\n"
+        "      PRINT \"row\" << i << x << i * 7;\n"
+        "      x := x + 1.5;\n"
+        "      i := i - 1;\n"
+        "   ENDWHILE;\n"
+        "END.\n";
+}
+
+//Reads 'pairs' INTEGER and REAL values, the input comes from read_input
+string read_program(int pairs)
+{
+    return "PROGRAM Reader;\n"
+        "VAR i, a, s: INTEGER;\n"
+        "    b, f: REAL;\n"
+        "BEGIN\n"
+        "   i := " + to_string(pairs) + "; s := 0; f := 0.0;\n"
+        "   WHILE (i):\n"
+        "      READ a; READ b;\n"
+        "      s := s + a; f := f + b;\n"
+        "      i := i - 1;\n"
+        "   ENDWHILE;\n"
+        "   PRINT s << f;\n"
+        "END.\n";
+}
+
+string read_input(int pairs)
+{
+    string text;
+    for (int i = 0; i < pairs; i++)
+        text += to_string(i % 2001 - 1000) + " " + to_string(i % 97) + ".25\n";
+    return text;
+}
+
+/* ###############################
+   #        PIPELINE             #
+   ###############################
+*/
+
+//Parses, analyzes and optimizes a program as main does, then runs it on one engine
+void run_program(const string& text, const string& engine, RunContext& context)
+{
+    Arena arena;
+    Parser parser(Lexer(string_view(text)), &arena);
+    boostvar tree = parser.parse();
+    Optimizer optimizer(&arena);
+    optimizer.eliminate_dead_code(tree);
+    SemanticAnalyzer semantic_analyser(&arena);
+    semantic_analyser.visit(tree);
+    optimizer.optimize(tree);
+
+    if (engine == "vm")
+    {
+        BytecodeCompiler compiler;
+        unique_ptr<BytecodeProgram> program(compiler.compile(tree));
+        VM vm(program.get(), &context);
+        vm.run();
+    }
+    else if (engine == "closure")
+    {
+        ClosureCompiler compiler;
+        ClosureEngine closure_engine(compiler.compile(tree), &context);
+        closure_engine.run();
+    }
+    else if (engine == "jit")
+    {
+        Jit jit(&context, 1000);
+        Interpreter interpreter(tree, &context, &jit);
+        interpreter.interpret();
+    }
+    else
+    {
+        Interpreter interpreter(tree, &context);
+        interpreter.interpret();
+    }
+}
+
+//A file the READ benchmark can read again from the start for every repetition
+int open_input_file(const string& contents)
+{
+    FILE* file = tmpfile();
+    if (file == NULL)
+        fail("Could not create the input file for the READ benchmark");
+    fwrite(contents.data(), 1, contents.size(), file);
+    fflush(file);
+    return fileno(file);
+}
+
+void rewind_input(int fd)
+{
+#ifdef _WIN32
+    _lseek(fd, 0, SEEK_SET);
+#else
+    lseek(fd, 0, SEEK_SET);
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    string filter = "";
+    int repetitions = 5;
+    double scale = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg.rfind("--filter=", 0) == 0)
+            filter = arg.substr(9);
+        else if (arg.rfind("--repetitions=", 0) == 0)
+            repetitions = max(1, stoi(arg.substr(14)));
+        else if (arg.rfind("--scale=", 0) == 0)
+            scale = stod(arg.substr(8));
+        else
+        {
+            cout << "ERROR:: Unknown option '" << arg << "', expected --filter=NAME, --repetitions=N or --scale=F" << endl;
+            return 10;
+        }
+    }
+
+    //A workload that fails ends the run like a program does under main
+    try
+    {
+        //Results go to stdout, everything the programs PRINT into the sink
+        static NullOutput sink;
+
+        BenchmarkRunner runner(filter, repetitions, scale);
+
+        string corpus = declarations_program(runner.scaled(20000));
+        runner.measure("micro/lexer/get_next_token", corpus.size() / 1e6, "MB", [&]() {
+            Lexer lexer{ string_view(corpus) };
+            auto start = chrono::steady_clock::now();
+            while (lexer.get_next_token().type != EOL);
+            return seconds_since(start);
+        });
+
+        int corpus_nodes = 0;
+        {
+            Arena arena;
+            Parser parser(Lexer(string_view(corpus)), &arena);
+            corpus_nodes = count_nodes(parser.parse());
+        }
+        runner.measure("micro/parser/parse", corpus_nodes, "nodes", [&]() {
+            Arena arena;
+            Parser parser(Lexer(string_view(corpus)), &arena);
+            auto start = chrono::steady_clock::now();
+            parser.parse();
+            return seconds_since(start);
+        });
+
+        runner.measure("micro/semantic/visit", corpus_nodes, "nodes", [&]() {
+            Arena arena;
+            Parser parser(Lexer(string_view(corpus)), &arena);
+            boostvar tree = parser.parse();
+            SemanticAnalyzer semantic_analyser(&arena);
+            auto start = chrono::steady_clock::now();
+            semantic_analyser.visit(tree);
+            return seconds_since(start);
+        });
+
+        int iterations = runner.scaled(1000000);
+        string arithmetic = arithmetic_program(iterations);
+        runner.measure("micro/interpreter/interpret", iterations, "iterations", [&]() {
+            Arena arena;
+            Parser parser(Lexer(string_view(arithmetic)), &arena);
+            boostvar tree = parser.parse();
+            SemanticAnalyzer semantic_analyser(&arena);
+            semantic_analyser.visit(tree);
+            RunContext context(&sink, -1);
+            Interpreter interpreter(tree, &context);
+            auto start = chrono::steady_clock::now();
+            interpreter.interpret();
+            return seconds_since(start);
+        });
+
+        int calls = runner.scaled(300000);
+        int lines = runner.scaled(200000);
+        int pairs = runner.scaled(500000);
+        string call_heavy = call_program(calls);
+        string print_heavy = print_program(lines);
+        string read_heavy = read_program(pairs);
+        int input = open_input_file(read_input(pairs));
+
+        for (string engine : { "tree", "vm", "closure", "jit" })
+        {
+            runner.measure("macro/arithmetic_loop/" + engine, iterations, "iterations", [&]() {
+                RunContext context(&sink, -1);
+                auto start = chrono::steady_clock::now();
+                run_program(arithmetic, engine, context);
+                return seconds_since(start);
+            });
+            runner.measure("macro/call_heavy/" + engine, calls + (calls / 100) * 101, "calls", [&]() {
+                RunContext context(&sink, -1);
+                auto start = chrono::steady_clock::now();
+                run_program(call_heavy, engine, context);
+                return seconds_since(start);
+            });
+            runner.measure("macro/print_heavy/" + engine, lines, "lines", [&]() {
+                RunContext context(&sink, -1);
+                auto start = chrono::steady_clock::now();
+                run_program(print_heavy, engine, context);
+                return seconds_since(start);
+            });
+            runner.measure("macro/read_heavy/" + engine, 2.0 * pairs, "values", [&]() {
+                rewind_input(input);
+                RunContext context(&sink, input);
+                auto start = chrono::steady_clock::now();
+                run_program(read_heavy, engine, context);
+                return seconds_since(start);
+            });
+        }
+
+        runner.print_json(cout);
+    }
+    catch (exception& error)
+    {
+        cout << "ERROR:: " << error.what() << endl;
+        return 10;
+    }
+}
@@ -0,0 +1,531 @@
+#pragma once
+#include "vm.h"
+#include "source.h"
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#endif
+
+/* ###############################
+   #        PROGRAM CACHE        #
+   ###############################
+*/
+
+//Bump whenever the bytecode or the layout below changes, older artifacts are then recompiled
+const uint32_t CACHE_VERSION = 2;
+const char CACHE_MAGIC[8] = { 'D', 'C', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+//64-bit hash of the source a word at a time, it only has to tell versions of a file apart
+uint64_t hash_source(string_view text)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ text.size();
+    size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text.data() + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < text.size(); i++)
+        hash = (hash ^ (unsigned char)text[i]) * 0x100000001B3ULL;
+    return hash ^ (hash >> 29);
+}
+
+//Checksum of an artifact's payload, four independent lanes so that it runs at memory speed
+uint64_t checksum_bytes(string_view bytes)
+{
+    uint64_t lanes[4] = { 0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL };
+    size_t i = 0;
+    for (; i + 32 <= bytes.size(); i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes.data() + i + 8 * lane, 8);
+            lanes[lane] = (lanes[lane] ^ word) * 0x9E3779B97F4A7C15ULL;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    uint64_t tail = hash_source(bytes.substr(i));
+    return hash_source(string_view(reinterpret_cast<const char*>(lanes), sizeof(lanes))) ^ tail;
+}
+
+//Appends the fields of an artifact, numbers in the machine's own layout
+class ArtifactWriter
+{
+
+public:
+    string bytes;
+
+    template<typename T>
+    void write(T value)
+    {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void write_string(const string& text)
+    {
+        write<uint32_t>(text.size());
+        bytes += text;
+    }
+
+    //Pads to 'alignment' first, so that the block can be used in place once mapped
+    void write_block(const void* data, size_t size, size_t alignment)
+    {
+        bytes.resize((bytes.size() + alignment - 1) / alignment * alignment, '\0');
+        bytes.append(static_cast<const char*>(data), size);
+    }
+};
+
+//Reads the fields back in the same order, a read past the end marks the artifact as damaged
+class ArtifactReader
+{
+    const char* data;
+    size_t size;
+    size_t pos;
+
+public:
+    bool ok;
+
+    ArtifactReader(string_view bytes)
+    {
+        this->data = bytes.data();
+        this->size = bytes.size();
+        this->pos = 0;
+        this->ok = true;
+    }
+
+    template<typename T>
+    T read()
+    {
+        T value{};
+        if (!ok || pos + sizeof(T) > size)
+        {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    string read_string()
+    {
+        uint32_t length = read<uint32_t>();
+        if (!ok || pos + length > size)
+        {
+            ok = false;
+            return "";
+        }
+        string text(data + pos, length);
+        pos += length;
+        return text;
+    }
+
+    //Everything not read yet
+    string_view rest()
+    {
+        return string_view(data + pos, size - pos);
+    }
+
+    const char* read_block(size_t size, size_t alignment)
+    {
+        pos = (pos + alignment - 1) / alignment * alignment;
+        if (!ok || pos + size > this->size)
+        {
+            ok = false;
+            return NULL;
+        }
+        const char* block = data + pos;
+        pos += size;
+        return block;
+    }
+};
+
+/*
+   --cache keeps the bytecode of every program it compiles in a directory, one file per
+   source and optimizer setting named after a hash of the source, and a later run of the
+   same source loads that file instead of lexing, parsing, analysing and compiling it
+   again. The file is mapped and the VM runs the instructions where they lie, so loading
+   costs little more than rebuilding the frame layouts and constants around them.
+
+   Nothing in an artifact is trusted. The header names the version and layout it was
+   written for. A copy of the source follows that must match the program being run
+   byte for byte, so another source that merely has the same hash is never run with
+   it, and a checksum covers everything after that copy. Every operand is then checked
+   against the procedures, constants and frames it indexes, and the stack depth along
+   the code, before the VM gets it. An artifact failing any of this is compiled over.
+
+   A loaded program points into this object, which must outlive the VM running it.
+*/
+class ProgramCache
+{
+    string path;
+    string_view source;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t flags;                 //compiler settings that change the bytecode
+    unique_ptr<SourceFile> artifact;
+    deque<string> messages;         //PRINT texts of the loaded program, constants point at them
+
+public:
+    ProgramCache(string directory, string_view source, bool optimize)
+    {
+        this->source = source;
+        this->source_hash = hash_source(source);
+        this->source_size = source.size();
+        this->flags = optimize ? 1 : 0;
+
+        char name[48];
+        snprintf(name, sizeof(name), "%016llx-%u.dcc", (unsigned long long)source_hash, flags);
+        this->path = directory + "/" + name;
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+
+    //The cached program, or NULL when there is none for this source yet
+    BytecodeProgram* load()
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return NULL;
+        artifact.reset(new SourceFile(path));
+        ArtifactReader reader(artifact->text());
+
+        char magic[8];
+        for (char& c : magic)
+            c = reader.read<char>();
+        if (memcmp(magic, CACHE_MAGIC, 8) != 0 || reader.read<uint32_t>() != CACHE_VERSION
+            || reader.read<uint32_t>() != sizeof(Instruction) + (sizeof(Value) << 8) || reader.read<uint32_t>() != flags
+            || reader.read<uint64_t>() != source_size || reader.read<uint64_t>() != source_hash || !reader.ok)
+            return discard(NULL);
+        uint64_t checksum = reader.read<uint64_t>();
+        const char* stored_source = reader.read_block(source_size, 1);
+        if (!reader.ok || memcmp(stored_source, source.data(), source_size) != 0 || checksum_bytes(reader.rest()) != checksum)
+            return discard(NULL);
+
+        BytecodeProgram* program = new BytecodeProgram();
+        uint32_t procedure_count = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < procedure_count && reader.ok; i++)
+        {
+            string name = reader.read_string();
+            int level = reader.read<int32_t>();
+            int inherited = reader.read<int32_t>();
+            int frame_size = reader.read<int32_t>();
+            //Every slot of the frame's own has its name stored, which bounds how many there can be
+            if (!reader.ok || inherited < 0 || frame_size < inherited || size_t(frame_size - inherited) > reader.rest().size() / 4)
+                return discard(program);
+
+            //Procedures come in declaration order, so the enclosing one is the last seen a level up
+            CodeObject* enclosing = NULL;
+            for (int j = program->procedures.size() - 1; j >= 0 && !enclosing; j--)
+            {
+                if (program->procedures[j]->level == level - 1)
+                    enclosing = program->procedures[j];
+            }
+            if ((i == 0 && (level != 1 || inherited != 0)) || level < 1 || (level > 1 && !enclosing)
+                || inherited > (enclosing ? enclosing->frame_size : 0))
+                return discard(program);
+            CodeObject* code = new CodeObject(name, level, inherited, frame_size, enclosing);
+            program->procedures.push_back(code);
+
+            uint32_t param_count = reader.read<uint32_t>();
+            for (uint32_t j = 0; j < param_count && reader.ok; j++)
+                code->param_slots.push_back(reader.read<int32_t>());
+            for (int i = 0; i < frame_size - inherited && reader.ok; i++)
+                code->slot_names[i] = reader.read_string();
+
+            uint32_t instruction_count = reader.read<uint32_t>();
+            code->instructions = reinterpret_cast<const Instruction*>(
+                reader.read_block(size_t(instruction_count) * sizeof(Instruction), alignof(Instruction)));
+            code->instruction_count = instruction_count;
+        }
+
+        //Numbers are copied as they are, the PRINT texts are put back in their places after
+        uint32_t constant_count = reader.read<uint32_t>();
+        const Value* constants = reinterpret_cast<const Value*>(
+            reader.read_block(size_t(constant_count) * sizeof(Value), alignof(Value)));
+        if (reader.ok)
+            program->constants.assign(constants, constants + constant_count);
+        uint32_t message_count = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < message_count && reader.ok; i++)
+        {
+            uint32_t index = reader.read<uint32_t>();
+            messages.push_back(reader.read_string());
+            if (index >= constant_count)
+                return discard(program);
+            program->constants[index] = Value(&messages.back());
+        }
+
+        uint32_t name_count = reader.read<uint32_t>();
+        for (uint32_t i = 0; i < name_count && reader.ok; i++)
+            program->names.push_back(reader.read_string());
+
+        if (!reader.ok || program->procedures.empty() || !verify(program))
+            return discard(program);
+        return program;
+    }
+
+    //Writes the artifact for this source, if that fails the next run just compiles again
+    void store(BytecodeProgram* program)
+    {
+        ArtifactWriter writer;
+        writer.write_block(CACHE_MAGIC, 8, 1);
+        writer.write<uint32_t>(CACHE_VERSION);
+        writer.write<uint32_t>(sizeof(Instruction) + (sizeof(Value) << 8));
+        writer.write<uint32_t>(flags);
+        writer.write<uint64_t>(source_size);
+        writer.write<uint64_t>(source_hash);
+        size_t checksum_at = writer.bytes.size();
+        writer.write<uint64_t>(0);      //of what follows the source, filled in once that is written
+        writer.write_block(source.data(), source.size(), 1);
+        size_t payload_at = writer.bytes.size();
+
+        writer.write<uint32_t>(program->procedures.size());
+        for (CodeObject* code : program->procedures)
+        {
+            writer.write_string(code->name);
+            writer.write<int32_t>(code->level);
+            writer.write<int32_t>(code->inherited);
+            writer.write<int32_t>(code->frame_size);
+            writer.write<uint32_t>(code->param_slots.size());
+            for (int slot : code->param_slots)
+                writer.write<int32_t>(slot);
+            for (string& name : code->slot_names)
+                writer.write_string(name);
+            writer.write<uint32_t>(code->code.size());
+            writer.write_block(code->code.data(), code->code.size() * sizeof(Instruction), alignof(Instruction));
+        }
+
+        //PRINT texts are left out of the block, their pointers mean nothing to the next run
+        vector<Value> numbers = program->constants;
+        vector<uint32_t> texts;
+        for (uint32_t i = 0; i < numbers.size(); i++)
+        {
+            if (numbers[i].which() == 2)
+            {
+                texts.push_back(i);
+                numbers[i] = Value(0);
+            }
+        }
+        writer.write<uint32_t>(numbers.size());
+        writer.write_block(numbers.data(), numbers.size() * sizeof(Value), alignof(Value));
+        writer.write<uint32_t>(texts.size());
+        for (uint32_t index : texts)
+        {
+            writer.write<uint32_t>(index);
+            writer.write_string(program->constants[index].as_string());
+        }
+
+        writer.write<uint32_t>(program->names.size());
+        for (string& name : program->names)
+            writer.write_string(name);
+        uint64_t checksum = checksum_bytes(string_view(writer.bytes).substr(payload_at));
+        memcpy(&writer.bytes[checksum_at], &checksum, sizeof(checksum));
+
+        //Written under a temporary name and renamed, so no run ever maps half an artifact.
+        //The counter keeps the names apart when several threads of a batch store at once
+        static atomic<unsigned> stores(0);
+#ifdef _WIN32
+        string temporary = path + "." + to_string(_getpid()) + "." + to_string(stores++);
+        remove(path.c_str());
+#else
+        string temporary = path + "." + to_string(getpid()) + "." + to_string(stores++);
+#endif
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == NULL)
+            return;
+        bool written = fwrite(writer.bytes.data(), 1, writer.bytes.size(), file) == writer.bytes.size();
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+            remove(temporary.c_str());
+    }
+
+private:
+    /*
+       Checks that running the code can only index what exists: opcodes, constants, frame
+       slots, enclosing frames, jump targets, procedures and parameter names. It also
+       follows the depth of the operand stack, relative to where the procedure started,
+       and rejects code that would pop below that or reach an instruction with two
+       different depths. One pass in order is enough because the compiler only jumps
+       backwards to code it already reached by falling through or jumping forwards.
+    */
+    bool verify(BytecodeProgram* program)
+    {
+        size_t procedure_count = program->procedures.size();
+        for (size_t p = 0; p < procedure_count; p++)
+        {
+            CodeObject* code = program->procedures[p];
+            for (int slot : code->param_slots)
+            {
+                if (slot < 0 || slot >= code->frame_size)
+                    return false;
+            }
+            size_t count = code->instruction_count;
+            const Instruction* instructions = code->instructions;
+            if (instructions == NULL || count == 0)
+                return false;
+            //Kept in locals, the compiler could not tell the depths written below from them
+            int frame_size = code->frame_size;
+            size_t constant_count = program->constants.size(), name_count = program->names.size();
+
+            //The stack depth on reaching each instruction, and at count on falling off the end.
+            //A byte each keeps this cheap on large programs; deeper code is just recompiled.
+            const unsigned char UNSEEN = 255;
+            vector<unsigned char> depths(count + 1, UNSEEN);
+            int depth = 0;
+            bool reached = true;                    //whether the previous instruction falls through
+            for (size_t ip = 0; ip < count; ip++)
+            {
+                if (depths[ip] == UNSEEN)
+                {
+                    if (!reached)
+                        continue;                   //unreachable so far, a later jump back here is rejected
+                    depths[ip] = depth;
+                }
+                else if (reached && depths[ip] != depth)
+                    return false;
+                depth = depths[ip];
+
+                const Instruction& instruction = instructions[ip];
+                int operand = instruction.operand;
+                int pops = 0, pushes = 0;
+                long target = -1;                   //the other successor, if any
+                reached = true;
+                switch (instruction.op)
+                {
+                case OP_CONST:
+                    if (operand < 0 || (size_t)operand >= constant_count)
+                        return false;
+                    pushes = 1;
+                    break;
+
+                case OP_LOAD:
+                case OP_STORE:
+                case OP_STORE_INTEGER:
+                case OP_CACHE:
+                case OP_INVALIDATE:
+                    if (operand < 0 || operand >= frame_size)
+                        return false;
+                    pushes = instruction.op == OP_LOAD || instruction.op == OP_CACHE;
+                    pops = instruction.op != OP_LOAD && instruction.op != OP_INVALIDATE;
+                    break;
+
+                case OP_LOAD_CACHED:
+                    //A cached value is pushed and the jump after it taken, otherwise that jump is skipped
+                    if (operand < 0 || operand >= frame_size || ip + 2 > count)
+                        return false;
+                    pushes = 1;
+                    target = ip + 2;
+                    break;
+
+                case OP_LOAD_OUTER:
+                case OP_STORE_OUTER:
+                {
+                    FrameLayout* outer = code;
+                    while (outer && outer->level > instruction.level)
+                        outer = outer->enclosing;
+                    if (outer == NULL || outer->level != instruction.level || operand < 0 || operand >= outer->frame_size)
+                        return false;
+                    pushes = instruction.op == OP_LOAD_OUTER;
+                    pops = instruction.op == OP_STORE_OUTER;
+                    break;
+                }
+
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_INTEGER_DIV: case OP_FLOAT_DIV: case OP_POW:
+                    pops = 2;
+                    pushes = 1;
+                    break;
+
+                case OP_NEG:
+                    pops = pushes = 1;
+                    break;
+
+                case OP_JUMP:
+                case OP_LOOP:
+                case OP_JUMP_IF_FALSE:
+                    if (operand < 0 || (size_t)operand >= count)
+                        return false;
+                    pops = instruction.op == OP_JUMP_IF_FALSE;
+                    reached = instruction.op == OP_JUMP_IF_FALSE;
+                    target = operand;
+                    break;
+
+                case OP_CHECK_INTEGER:
+                    if (operand < 0 || (size_t)operand >= name_count)
+                        return false;
+                    pops = pushes = 1;
+                    break;
+
+                case OP_CALL:
+                case OP_TAIL_CALL:
+                    if (operand < 1 || (size_t)operand >= procedure_count || (p == 0 && instruction.op == OP_TAIL_CALL))
+                        return false;
+                    pops = program->procedures[operand]->param_slots.size();
+                    reached = instruction.op == OP_CALL;
+                    break;
+
+                case OP_RETURN:
+                    if (p == 0)
+                        return false;
+                    reached = false;
+                    break;
+
+                case OP_ARITY_ERROR:
+                case OP_HALT:
+                    reached = false;
+                    break;
+
+                case OP_READ:
+                    pushes = 1;
+                    break;
+
+                case OP_PRINT:
+                    pops = 1;
+                    break;
+
+                case OP_PRINT_END:
+                    break;
+
+                default:
+                    return false;
+                }
+
+                if (depth < pops)
+                    return false;
+                int after = depth - pops + pushes;
+                if (after >= UNSEEN)
+                    return false;
+                if (target >= 0)
+                {
+                    //OP_LOAD_CACHED reaches the jump after it with the value pushed, the target without
+                    int target_depth = instruction.op == OP_LOAD_CACHED ? depth : after;
+                    if (depths[target] == UNSEEN && (size_t)target > ip)
+                        depths[target] = target_depth;
+                    else if (depths[target] != target_depth)
+                        return false;
+                }
+                depth = after;
+            }
+            //Only an instruction that does not fall through may end the code
+            if (reached || depths[count] != UNSEEN)
+                return false;
+        }
+        return true;
+    }
+
+    BytecodeProgram* discard(BytecodeProgram* program)
+    {
+        delete program;
+        messages.clear();
+        artifact.reset();
+        return NULL;
+    }
+};
@@ -0,0 +1,392 @@
+#pragma once
+#include "vm.h"
+#include <functional>
+
+/* ###############################
+   #     CLOSURE COMPILER        #
+   ###############################
+*/
+
+class ClosureProcedure;
+
+//Runtime state threaded through the compiled closures
+class ClosureContext
+{
+
+public:
+    RunContext* run;                //where READ and PRINT go
+    FrameStack variables;
+    int base;
+    ClosureProcedure* tail_call;    //callee of a tail call, waiting for its caller's frame to be popped
+
+    ClosureContext()
+    {
+        this->run = NULL;
+        this->base = 0;
+        this->tail_call = NULL;
+    }
+};
+
+typedef function<Value(ClosureContext&)> Evaluator;   //expressions
+typedef function<void(ClosureContext&)> Executor;       //statements
+typedef Value(*BinaryKernel)(const Value&, const Value&);
+
+class ClosureProcedure : public FrameLayout
+{
+
+public:
+    Executor body;
+
+    ClosureProcedure(string name, int level, int inherited, int frame_size, FrameLayout* enclosing = NULL)
+        : FrameLayout(name, level, inherited, frame_size, enclosing) {}
+};
+
+/*
+   Converts every AST node once into a pre-bound callable. Slots, constants and
+   operator kernels are resolved here, so running the program never looks at
+   op.type strings or which() tags again. The procedures it returns belong to the
+   compiler and live as long as it does.
+*/
+class ClosureCompiler
+{
+    vector<ClosureProcedure*> layouts;  //innermost procedure being compiled last
+    unordered_map<Block*, ClosureProcedure*> procedures;
+    ClosureProcedure* main_procedure;
+
+public:
+    ClosureCompiler()
+    {
+        this->main_procedure = NULL;
+    }
+
+    ClosureCompiler(const ClosureCompiler&) = delete;
+    ClosureCompiler& operator=(const ClosureCompiler&) = delete;
+
+    ~ClosureCompiler()
+    {
+        delete main_procedure;
+        for (auto& entry : procedures)
+            delete entry.second;
+    }
+
+    [[noreturn]] void error(string error_code)
+    {
+        fail(error_code);
+    }
+
+    ClosureProcedure* compile(boostvar tree)
+    {
+        Program* program_node = boost::get<Program*>(tree);
+        main_procedure = new ClosureProcedure(program_node->name, 1, 0, program_node->frame_size);
+        layouts.push_back(main_procedure);
+        main_procedure->body = compile_block(boost::get<Block*>(program_node->block));
+        layouts.pop_back();
+        return main_procedure;
+    }
+
+private:
+    static void runtime_error(string message)
+    {
+        fail(message);
+    }
+
+    Executor compile_block(Block* node)
+    {
+        for (auto declaration : node->declarations)
+        {
+            if (declaration.which() == 9)
+                layouts.back()->declare(boost::get<Var*>(boost::get<VarDecl*>(declaration)->var_node));
+            else if (declaration.which() == 13)
+                compile_procedure(boost::get<ProcedureDecl*>(declaration));
+        }
+        return compile_statement(node->compound_statement);
+    }
+
+    void compile_procedure(ProcedureDecl* node)
+    {
+        ProcedureSymbol* proc_symbol = node->proc_symbol;
+        ClosureProcedure* procedure = new ClosureProcedure(node->proc_name, proc_symbol->scope_level + 1, proc_symbol->inherited, proc_symbol->frame_size, layouts.back());
+        procedures[boost::get<Block*>(node->block_node)] = procedure;
+
+        layouts.push_back(procedure);
+        for (auto param : node->params)
+            procedure->declare_param(boost::get<Var*>(boost::get<Param*>(param)->var_node));
+        procedure->body = compile_block(boost::get<Block*>(node->block_node));
+        layouts.pop_back();
+    }
+
+    Executor compile_statements(vector<boostvar>& statements)
+    {
+        vector<Executor> compiled;
+        for (auto statement : statements)
+        {
+            if (statement.which() != 6)
+                compiled.push_back(compile_statement(statement));
+        }
+
+        if (compiled.size() == 1)
+            return compiled[0];
+        return [compiled](ClosureContext& ctx) {
+            for (const Executor& statement : compiled)
+                statement(ctx);
+        };
+    }
+
+    Executor compile_statement(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 3:
+            return compile_statements(boost::get<Compound*>(node)->children);
+        case 4:
+            return compile_assign(boost::get<Assign*>(node));
+        case 6:
+            return [](ClosureContext&) {};
+        case 16:
+            return compile_print(boost::get<Print*>(node));
+        case 17:
+            return compile_call(boost::get<ProcedureCall*>(node));
+        case 18:
+            return compile_read(boost::get<Read*>(node));
+        case 19:
+            return compile_condition(boost::get<Condition*>(node));
+        case 20:
+            return compile_loop(boost::get<Loop*>(node));
+        default:
+            error("INVALID PARSING METHOD");
+            return NULL;
+        }
+    }
+
+    Executor compile_store(Var* variable, bool integer_target, Evaluator value)
+    {
+        int slot = variable->slot;
+        int level = variable->depth;
+        string var_name = variable->value;
+        if (integer_target)
+        {
+            return [slot, level, var_name, value](ClosureContext& ctx) {
+                Value val = value(ctx);
+                if (val.which() == 1)
+                    runtime_error("Incompatible type: variable '" + var_name + "'");
+                ctx.variables.store(ctx.variables.display[level], slot, val);
+            };
+        }
+        if (level == layouts.back()->level)
+        {
+            return [slot, value](ClosureContext& ctx) {
+                ctx.variables.store(ctx.base, slot, value(ctx));
+            };
+        }
+        //Declared in an enclosing scope, its frame is found through the display
+        return [slot, level, value](ClosureContext& ctx) {
+            ctx.variables.store(ctx.variables.display[level], slot, value(ctx));
+        };
+    }
+
+    Executor compile_assign(Assign* node)
+    {
+        return compile_store(boost::get<Var*>(node->left), node->integer_target, compile_expression(node->right));
+    }
+
+    Executor compile_read(Read* node)
+    {
+        Evaluator input = [](ClosureContext& ctx) { return ctx.run->input.read_value(); };
+        return compile_store(boost::get<Var*>(node->var), node->integer_target, input);
+    }
+
+    Executor compile_print(Print* node)
+    {
+        vector<Evaluator> messages;
+        for (auto message : node->messages)
+            messages.push_back(compile_expression(message));
+
+        return [messages](ClosureContext& ctx) {
+            for (const Evaluator& message : messages)
+                ctx.run->output.print_value(message(ctx));
+            ctx.run->output.print_end();
+        };
+    }
+
+    Executor compile_call(ProcedureCall* node)
+    {
+        ProcedureSymbol* proc_symbol = node->proc_symbol;
+        ClosureProcedure* procedure = procedures[boost::get<Block*>(proc_symbol->block_node)];
+
+        if (proc_symbol->params.size() != node->actual_params.size())
+        {
+            string message = proc_symbol->params.size() > node->actual_params.size() ?
+                "Too few arguments given in the function call." : "Too many arguments given in the function call.";
+            return [message](ClosureContext&) { runtime_error(message); };
+        }
+
+        vector<Evaluator> args;
+        vector<string> integer_params;  //name of the parameter when it must not receive a REAL
+        for (size_t i = 0; i < node->actual_params.size(); i++)
+        {
+            args.push_back(compile_expression(node->actual_params[i]));
+            VarSymbol* var = boost::get<VarSymbol*>(proc_symbol->params[i]);
+            integer_params.push_back(node->integer_checks[i] ? var->name : "");
+        }
+
+        Executor stage_arguments = [args, integer_params](ClosureContext& ctx) {
+            vector<Value>& values = ctx.variables.arguments;
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                values.push_back(args[i](ctx));
+                if (!integer_params[i].empty() && values.back().which() == 1)
+                    runtime_error("Incompatible type: variable '" + integer_params[i] + "'");
+            }
+        };
+
+        //Nothing of the running procedure is left to do, the call that started it runs the callee
+        if (node->tail_call)
+        {
+            return [procedure, stage_arguments](ClosureContext& ctx) {
+                stage_arguments(ctx);
+                ctx.tail_call = procedure;
+            };
+        }
+
+        return [procedure, stage_arguments](ClosureContext& ctx) {
+            stage_arguments(ctx);
+            int caller_base = ctx.base;
+            ClosureProcedure* callee = procedure;
+            while (callee)
+            {
+                vector<Value>& values = ctx.variables.arguments;
+                int first = values.size() - callee->param_slots.size();
+                ctx.base = ctx.variables.enter(callee, values.data() + first);
+                values.resize(first);
+                callee->body(ctx);
+                ctx.variables.leave();
+
+                callee = ctx.tail_call;
+                ctx.tail_call = NULL;
+            }
+            ctx.base = caller_base;
+        };
+    }
+
+    Executor compile_condition(Condition* node)
+    {
+        Evaluator condition = compile_expression(node->condition_node);
+        Executor if_branch = compile_statements(node->if_statements);
+        Executor else_branch = compile_statements(node->else_statements);
+        return [condition, if_branch, else_branch](ClosureContext& ctx) {
+            if (is_truthy(condition(ctx)))
+                if_branch(ctx);
+            else
+                else_branch(ctx);
+        };
+    }
+
+    Executor compile_loop(Loop* node)
+    {
+        Evaluator condition = compile_expression(node->condition_node);
+        Executor body = compile_statements(node->statements);
+        vector<int> invariant_slots = node->invariant_slots;
+        return [condition, body, invariant_slots](ClosureContext& ctx) {
+            for (int slot : invariant_slots)
+                ctx.variables.invalidate(ctx.base, slot);
+            while (is_truthy(condition(ctx)))
+            {
+                body(ctx);
+                ctx.variables.loop_iterations++;
+            }
+        };
+    }
+
+    Evaluator compile_binary(BinaryKernel kernel, Evaluator left, Evaluator right)
+    {
+        return [kernel, left, right](ClosureContext& ctx) {
+            return kernel(left(ctx), right(ctx));
+        };
+    }
+
+    Evaluator compile_expression(boostvar node)
+    {
+        if (node.which() == 0)
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            Evaluator left = compile_expression(bin_op->left);
+            Evaluator right = compile_expression(bin_op->right);
+            switch (bin_op->op.type)
+            {
+            case PLUS: return compile_binary(add_values, left, right);
+            case MINUS: return compile_binary(subtract_values, left, right);
+            case MUL: return compile_binary(multiply_values, left, right);
+            case INTEGER_DIV: return compile_binary(integer_divide_values, left, right);
+            case FLOAT_DIV: return compile_binary(float_divide_values, left, right);
+            default: return compile_binary(power_values, left, right);
+            }
+        }
+        else if (node.which() == 1)
+        {
+            Value constant = boost::get<Num*>(node)->constant;
+            return [constant](ClosureContext&) { return constant; };
+        }
+        else if (node.which() == 2)
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            Evaluator expr = compile_expression(unary_op->expr);
+            if (unary_op->op.type == MINUS)
+                return [expr](ClosureContext& ctx) { return negate_value(expr(ctx)); };
+            return expr;
+        }
+        else if (node.which() == 5)
+        {
+            FrameLayout* layout = layouts.back();
+            Var* variable = boost::get<Var*>(node);
+            int slot = variable->slot;
+            int level = variable->depth;
+            if (level == layout->level)
+                return [layout, slot](ClosureContext& ctx) { return ctx.variables.load(layout, ctx.base, slot); };
+            return [layout, slot, level](ClosureContext& ctx) { return ctx.variables.load(layout, ctx.variables.display[level], slot); };
+        }
+        else if (node.which() == 21)
+        {
+            Value message(&boost::get<Message*>(node)->msg);
+            return [message](ClosureContext&) { return message; };
+        }
+        else if (node.which() == 22)
+        {
+            Invariant* invariant = boost::get<Invariant*>(node);
+            int slot = invariant->slot;
+            Evaluator expr = compile_expression(invariant->expr);
+            return [slot, expr](ClosureContext& ctx) -> Value {
+                if (!ctx.variables.assigned[ctx.base + slot])
+                    ctx.variables.store(ctx.base, slot, expr(ctx));
+                return ctx.variables.slots[ctx.base + slot];
+            };
+        }
+        error("INVALID PARSING METHOD");
+        return NULL;
+    }
+};
+
+class ClosureEngine
+{
+    ClosureProcedure* main_procedure;
+    ClosureContext ctx;
+
+public:
+    ClosureEngine(ClosureProcedure* main_procedure, RunContext* context, int max_depth = DEFAULT_MAX_DEPTH)
+    {
+        this->main_procedure = main_procedure;
+        this->ctx.run = context;
+        this->ctx.variables.max_depth = max_depth;
+    }
+
+    FrameStack& frame_stack()
+    {
+        return ctx.variables;
+    }
+
+    Value run()
+    {
+        ctx.base = ctx.variables.enter_program(main_procedure);
+        main_procedure->body(ctx);
+        return 0;
+    }
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+
+/* ###############################
+   #        ERRORS               #
+   ###############################
+*/
+
+/*
+   Every error in a program, from the lexer to the engines, ends the run it happened in
+   by throwing ProgramError with the message that follows "ERROR:: ". Whoever started
+   the run reports it: the command line tool prints it and exits with status 10, the
+   batch runner records it with that program's output and goes on with the next one.
+*/
+class ProgramError : public std::runtime_error
+{
+
+public:
+    ProgramError(const std::string& message) : std::runtime_error(message) {}
+};
+
+[[noreturn]] void fail(const std::string& message)
+{
+    throw ProgramError(message);
+}
+
+//What an INTEGER division by 'divisor' reports where the hardware would trap: by 0, or the smallest INTEGER by -1
+const char* division_error(int divisor)
+{
+    return divisor == 0 ? "Division by zero." : "Integer overflow in division.";
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include "parser.h"
+#include <vector>
+#include <cstdint>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <pthread.h>
+#endif
+
+/* ###############################
+   #     FRAMES                  #
+   ###############################
+*/
+
+//Slot layout of one procedure (or the main program), the slots come from the SemanticAnalyzer
+class FrameLayout
+{
+
+public:
+    string name;
+    int level;                  //nesting level of the scope, 1 for the main program
+    int inherited;              //slots numbered before this frame's own, they belong to the enclosing scopes
+    int frame_size;             //inherited + params + locals
+    vector<int> param_slots;
+    vector<string> slot_names;  //names of the frame's own slots, slot_names[slot - inherited]
+    FrameLayout* enclosing;     //names the inherited slots
+
+    FrameLayout(string name, int level, int inherited, int frame_size, FrameLayout* enclosing = NULL)
+    {
+        this->name = name;
+        this->level = level;
+        this->inherited = inherited;
+        this->frame_size = frame_size;
+        this->slot_names.resize(frame_size - inherited);
+        this->enclosing = enclosing;
+    }
+
+    void declare(Var* var)
+    {
+        slot_names[var->slot - inherited] = var->value;
+    }
+
+    //Only needed for error messages, so inherited names are looked up in the enclosing layouts
+    const string& slot_name(int slot)
+    {
+        FrameLayout* layout = this;
+        while (slot < layout->inherited && layout->enclosing)
+            layout = layout->enclosing;
+        return layout->slot_names[slot - layout->inherited];
+    }
+
+    void declare_param(Var* var)
+    {
+        declare(var);
+        param_slots.push_back(var->slot);
+    }
+};
+
+//Bookkeeping of one live frame, the variables themselves are in FrameStack::slots
+struct FrameRecord
+{
+    int base;       //slots[base + slot] is the frame's variable slot
+    int start;      //first element of slots the frame owns
+    int frame_size;
+    int level;
+    int link;       //display entry this frame replaced, put back when it is popped
+};
+
+//Low enough that the tree walker reaches it on an 8 MB stack, where each nested call
+//takes 1 to 1.5 KB of native stack depending on the statements it is nested in
+const int DEFAULT_MAX_DEPTH = 4000;
+
+/*
+   The variables of every live frame, laid out back to back and shared by all engines.
+   A frame only holds its own slots; its base is shifted down by the inherited count so
+   that base + slot still addresses them. display[level] is the base of the innermost
+   live frame of each nesting level, which is where a variable declared at that level is
+   found. Frames are pushed and popped LIFO on vectors that keep their capacity, so once
+   the deepest call has been reached no call allocates.
+
+   Recursion deeper than max_depth procedure frames is reported as an error. That is the
+   only limit on the VM, whose calls do not recurse natively. The tree walker (and the
+   JIT, which runs inside it) and the closure engine recurse on the native stack, so a
+   push is refused as well once the native stack has grown by 3/4 of its size since the
+   program's frame was pushed; whichever of the two checks fails first stops the run.
+*/
+class FrameStack
+{
+
+public:
+    vector<Value> slots;
+    vector<char> assigned;      //whether a slot holds a value yet
+    vector<int> display;
+    vector<FrameRecord> records;
+    vector<Value> arguments;    //evaluated in the caller before the callee's frame is pushed
+    int max_depth;              //procedure frames that may be live at once
+    long long calls;            //procedure frames pushed so far
+    long long loop_iterations;  //WHILE bodies run, counted by the engines
+    int peak_depth;             //most procedure frames that were live at once
+    uintptr_t stack_start;      //native stack address when the program's frame was pushed
+    size_t stack_budget;        //bytes the native stack may grow by past stack_start
+
+    FrameStack(int max_depth = DEFAULT_MAX_DEPTH)
+    {
+        this->max_depth = max_depth;
+        this->calls = this->loop_iterations = 0;
+        this->peak_depth = 0;
+        this->stack_start = 0;
+        this->stack_budget = native_stack_size() / 4 * 3;
+    }
+
+    static size_t native_stack_size()
+    {
+#ifdef _WIN32
+        return 1 << 20;
+#else
+#ifdef __GLIBC__
+        //Batch runs happen on worker threads, whose stacks are not the size of the rlimit
+        pthread_attr_t attributes;
+        size_t size = 0;
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+        {
+            pthread_attr_getstacksize(&attributes, &size);
+            pthread_attr_destroy(&attributes);
+        }
+        if (size > 0)
+            return size;
+#endif
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_STACK, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+            return size_t(256) << 20;
+        return limit.rlim_cur;
+#endif
+    }
+
+    [[noreturn]] void error(string message)
+    {
+        fail(message);
+    }
+
+    int push(int level, int inherited, int frame_size)
+    {
+        char marker;
+        uintptr_t here = (uintptr_t)&marker;
+        if (records.empty())
+            stack_start = here;
+        else if ((int)records.size() > max_depth)
+            error("Maximum recursion depth of " + to_string(max_depth) + " exceeded.");
+        else if ((stack_start > here ? stack_start - here : here - stack_start) > stack_budget)
+            error("Maximum recursion depth exceeded, the native stack is exhausted.");
+        if (!records.empty())
+        {
+            calls++;
+            peak_depth = max(peak_depth, (int)records.size());
+        }
+
+        int start = slots.size();
+        int base = start - inherited;
+        slots.resize(base + frame_size);
+        assigned.resize(base + frame_size, 0);
+
+        if ((int)display.size() <= level)
+            display.resize(level + 1, 0);
+        records.push_back({ base, start, frame_size, level, display[level] });
+        display[level] = base;
+        return base;
+    }
+
+    void pop()
+    {
+        FrameRecord& record = records.back();
+        display[record.level] = record.link;
+        slots.resize(record.start);
+        assigned.resize(record.start);
+        records.pop_back();
+    }
+
+    FrameRecord& top()
+    {
+        return records.back();
+    }
+
+    int enter_program(FrameLayout* layout)
+    {
+        slots.clear();
+        assigned.clear();
+        records.clear();
+        return push(layout->level, 0, layout->frame_size);
+    }
+
+    //Pushes the callee's frame and moves the arguments into its parameter slots
+    int enter(FrameLayout* callee, Value* args)
+    {
+        int base = push(callee->level, callee->inherited, callee->frame_size);
+        for (size_t i = 0; i < callee->param_slots.size(); i++)
+            store(base, callee->param_slots[i], args[i]);
+        return base;
+    }
+
+    void leave()
+    {
+        pop();
+    }
+
+    void invalidate(int base, int slot)
+    {
+        assigned[base + slot] = 0;
+    }
+
+    const Value& load(FrameLayout* layout, int base, int slot)
+    {
+        if (!assigned[base + slot])
+            error("Variable " + layout->slot_name(slot) + " not defined.");
+        return slots[base + slot];
+    }
+
+    void store(int base, int slot, Value value)
+    {
+        slots[base + slot] = value;
+        assigned[base + slot] = 1;
+    }
+};
@@ -0,0 +1,404 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* ###############################
+   #        GENERATOR            #
+   ###############################
+*/
+
+/*
+   Built next to main.cpp as its own executable. It writes a valid DeCipher program of a
+   chosen size and shape to stdout, for finding out how the lexer, parser, analyzer and
+   engines scale. The same options and --seed always give the same program: numbers are
+   drawn straight from mt19937, whose sequence the standard fixes, rather than through
+   the distributions, whose results differ between standard libraries.
+
+   Every variable is assigned before it is read and stays within VALUE_BOUND, so the
+   programs neither stop on an unset variable nor overflow, however long they run. Loops
+   count down a counter nothing else touches, so they always end after --trip-count
+   iterations. READ only fills INTEGER variables; --input=FILE writes as many integers as
+   the program will read.
+*/
+
+//Largest absolute value a variable holds, and an expression before it is scaled back down
+const long long VALUE_BOUND = 1000;
+const long long EXPRESSION_BOUND = 100000000;
+const long long FACTOR_BOUND = 30000; //the product of two factors stays within an int
+
+struct GeneratorOptions
+{
+    unsigned seed = 1;
+    long long lines = 1000;         //lines the program should have, roughly
+    int variables = 20;             //global variables, half INTEGER and half REAL
+    int locals = 4;                 //variables each procedure declares besides its parameters
+    int procedures = 10;
+    int nesting = 2;                //procedures declared inside each other, 1 keeps them all global
+    int expression_depth = 3;
+    int trip_count = 10;            //iterations of every WHILE loop
+    int loop_depth = 2;             //WHILE loops nested inside each other
+    int loops = 5;                  //percent of statements that start a WHILE loop
+    int prints = 5;                 //percent of statements that are PRINTs
+    int reads = 0;                  //percent of statements that are READs
+    string input = "";              //file to write the READ values to
+};
+
+struct Expression
+{
+    string text;
+    long long bound;    //largest absolute value it can evaluate to
+};
+
+class ProgramGenerator
+{
+    GeneratorOptions options;
+    mt19937 random;
+    ostream& out;
+    long long body_lines;           //lines each procedure body gets
+    int next_procedure;
+    vector<string> integers;        //INTEGER variables in scope, the innermost scope's last
+    vector<string> reals;
+
+public:
+    long long lines;
+    double read_values;             //values the program will READ when it runs
+
+    ProgramGenerator(GeneratorOptions options, ostream& out) : out(out)
+    {
+        this->options = options;
+        this->random.seed(options.seed);
+        this->next_procedure = 0;
+        this->lines = 0;
+        this->read_values = 0;
+
+        //Leaves the main program about the same share of the lines as every procedure
+        long long declarations = 4 + options.variables / 8 + options.variables + options.procedures * (7 + options.locals / 8 + options.locals);
+        this->body_lines = max(3LL, (options.lines - declarations) / (options.procedures + 1));
+    }
+
+    void generate()
+    {
+        line("PROGRAM Generated;");
+        vector<string> global_integers, global_reals;
+        for (int i = 0; i < (options.variables + 1) / 2; i++)
+            global_integers.push_back("n" + to_string(i));
+        for (int i = 0; i < options.variables / 2; i++)
+            global_reals.push_back("r" + to_string(i));
+        declare(global_integers, global_reals, "");
+        integers = global_integers;
+        reals = global_reals;
+
+        vector<string> calls;
+        while (next_procedure < options.procedures)
+        {
+            calls.push_back(procedure_name(next_procedure));
+            read_values += procedure(options.nesting, "");
+        }
+
+        line("BEGIN");
+        initialize("   ");
+        for (string& call : calls)
+            line("   " + call + "(" + expression(false).text + ", " + expression(true).text + ");");
+        read_values += statements(options.lines - lines - 1, "   ");
+        line("END.");
+    }
+
+    void write_input(ostream& input)
+    {
+        for (long long i = 0; i < (long long)read_values; i++)
+            input << (int)pick(2 * VALUE_BOUND + 1) - VALUE_BOUND << ((i + 1) % 16 == 0 ? "\n" : " ");
+        input << "\n";
+    }
+
+private:
+    void line(const string& text)
+    {
+        out << text << '\n';
+        lines++;
+    }
+
+    uint32_t pick(uint32_t count)
+    {
+        return random() % count;
+    }
+
+    string procedure_name(int index)
+    {
+        return "Proc" + to_string(index);
+    }
+
+    //The VAR section, with a counter for each level of loop nesting after the variables
+    void declare(const vector<string>& new_integers, const vector<string>& new_reals, string indent)
+    {
+        vector<string> counters;
+        for (int level = 1; level <= options.loop_depth; level++)
+            counters.push_back("trip" + to_string(level));
+        const vector<string>* lists[] = { &new_integers, &counters, &new_reals };
+
+        string keyword = "VAR ";
+        for (const vector<string>* names : lists)
+        {
+            for (size_t i = 0; i < names->size(); i += 8)
+            {
+                string list;
+                for (size_t j = i; j < names->size() && j < i + 8; j++)
+                    list += (j == i ? "" : ", ") + (*names)[j];
+                line(indent + keyword + list + (names == &new_reals ? ": REAL;" : ": INTEGER;"));
+                keyword = "    ";
+            }
+        }
+    }
+
+    //Assigns every variable of the innermost scope, the procedure parameters excepted
+    void initialize(string indent, int from_integer = 0, int from_real = 0)
+    {
+        for (int i = from_integer; i < (int)integers.size(); i++)
+            line(indent + integers[i] + " := " + to_string((int)pick(2 * VALUE_BOUND + 1) - VALUE_BOUND) + ";");
+        for (int i = from_real; i < (int)reals.size(); i++)
+            line(indent + reals[i] + " := " + to_string(pick(VALUE_BOUND)) + "." + to_string(pick(10)) + ";");
+    }
+
+    /*
+       Writes the next procedure and the ones nested inside it. Each calls the procedure
+       nested in it once, the main program calls the outermost ones. Returns the values
+       one call of it READs.
+    */
+    double procedure(int depth, string indent)
+    {
+        int index = next_procedure++;
+        string suffix = to_string(index);
+        line(indent + "PROCEDURE " + procedure_name(index) + "(a" + suffix + ": INTEGER; b" + suffix + ": REAL);");
+
+        int outer_integers = integers.size(), outer_reals = reals.size();
+        vector<string> local_integers, local_reals;
+        for (int i = 0; i < (options.locals + 1) / 2; i++)
+            local_integers.push_back("i" + suffix + "v" + to_string(i));
+        for (int i = 0; i < options.locals / 2; i++)
+            local_reals.push_back("f" + suffix + "v" + to_string(i));
+        declare(local_integers, local_reals, indent);
+        integers.push_back("a" + suffix);
+        reals.push_back("b" + suffix);
+        integers.insert(integers.end(), local_integers.begin(), local_integers.end());
+        reals.insert(reals.end(), local_reals.begin(), local_reals.end());
+
+        double reads = 0;
+        string nested = "";
+        if (depth > 1 && next_procedure < options.procedures)
+        {
+            nested = procedure_name(next_procedure);
+            reads += procedure(depth - 1, indent + "   ");
+        }
+
+        line(indent + "BEGIN");
+        initialize(indent + "   ", outer_integers + 1, outer_reals + 1);
+        if (!nested.empty())
+            line(indent + "   " + nested + "(" + expression(false).text + ", " + expression(true).text + ");");
+        reads += statements(body_lines, indent + "   ");
+        line(indent + "END;");
+
+        integers.resize(outer_integers);
+        reals.resize(outer_reals);
+        return reads;
+    }
+
+    //Writes statements until 'count' lines are filled, returns the values they READ
+    double statements(long long count, string indent)
+    {
+        double reads = 0;
+        long long last = lines + count;
+        while (lines < last)
+            reads += statement(0, 1, indent);
+        return reads;
+    }
+
+    //'runs' is how often the statement runs per call of its procedure
+    double statement(int level, double runs, string indent)
+    {
+        int roll = pick(100);
+        if (level < options.loop_depth && roll < options.loops)
+            return loop(level, runs, indent);
+        roll -= options.loops;
+
+        if (roll < options.prints)
+        {
+            string text = indent + "PRINT \"line" + to_string(lines + 1) + "\"";
+            for (int i = pick(3); i >= 0; i--)
+                text += " << " + expression(pick(2)).text;
+            line(text + ";");
+            return 0;
+        }
+        roll -= options.prints;
+
+        if (roll < options.reads)
+        {
+            line(indent + "READ " + integers[pick(integers.size())] + ";");
+            return runs;
+        }
+        roll -= options.reads;
+
+        if (roll < 5)
+            line(indent + "IF (" + expression(false).text + "): " + assignment() + " ELSE: " + assignment() + " ENDIF;");
+        else
+            line(indent + assignment() + ";");
+        return 0;
+    }
+
+    double loop(int level, double runs, string indent)
+    {
+        string counter = "trip" + to_string(level + 1);
+        line(indent + counter + " := " + to_string(options.trip_count) + ";");
+        line(indent + "WHILE (" + counter + "):");
+        double reads = 0;
+        for (int i = pick(4); i >= 0; i--)
+            reads += statement(level + 1, runs * options.trip_count, indent + "   ");
+        line(indent + "   " + counter + " := " + counter + " - 1;");
+        line(indent + "ENDWHILE;");
+        return reads;
+    }
+
+    string assignment()
+    {
+        bool real = pick(2);
+        vector<string>& targets = real ? reals : integers;
+        return targets[pick(targets.size())] + " := " + expression(real).text;
+    }
+
+    //A full expression, scaled down so that it can be stored
+    Expression expression(bool real)
+    {
+        return scaled(expression(options.expression_depth, real), VALUE_BOUND, real);
+    }
+
+    /*
+       INTEGER and REAL are never mixed in one expression, the engines do not convert
+       between them. Division is only by constants, so nothing divides by zero.
+    */
+    Expression expression(int depth, bool real)
+    {
+        if (depth <= 0 || pick(10) < 2)
+        {
+            if (pick(2))
+            {
+                vector<string>& names = real ? reals : integers;
+                return { names[pick(names.size())], VALUE_BOUND };
+            }
+            long long value = pick(100);
+            return { to_string(value) + (real ? "." + to_string(pick(10)) : ""), value + 1 };
+        }
+
+        Expression left = expression(depth - 1, real);
+        Expression result;
+        switch (pick(real ? 5 : 6))
+        {
+        case 0:
+        case 1:
+        {
+            Expression right = expression(depth - 1, real);
+            result = { "(" + left.text + (pick(2) ? " + " : " - ") + right.text + ")", left.bound + right.bound };
+            break;
+        }
+        case 2:
+        {
+            left = scaled(left, FACTOR_BOUND, real);
+            Expression right = scaled(expression(depth - 1, real), FACTOR_BOUND, real);
+            result = { "(" + left.text + " * " + right.text + ")", left.bound * right.bound };
+            break;
+        }
+        case 3:
+        {
+            string divisor = to_string(2 + pick(8));
+            result = { "(" + left.text + (real ? " / " + divisor + ".0" : " DIV " + divisor) + ")", left.bound };
+            break;
+        }
+        case 4:
+            result = { "-" + left.text, left.bound };
+            break;
+        default:
+            left = scaled(left, FACTOR_BOUND, real);
+            result = { "(" + left.text + " ^ 2)", left.bound * left.bound };
+            break;
+        }
+        return scaled(result, EXPRESSION_BOUND, real);
+    }
+
+    Expression scaled(Expression expression, long long bound, bool real)
+    {
+        if (expression.bound <= bound)
+            return expression;
+        long long divisor = (expression.bound + bound - 1) / bound;
+        string text = "(" + expression.text + (real ? " / " + to_string(divisor) + ".0" : " DIV " + to_string(divisor)) + ")";
+        return { text, (expression.bound + divisor - 1) / divisor };
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    GeneratorOptions options;
+    vector<pair<string, int*>> numbers = {
+        { "--variables=", &options.variables }, { "--locals=", &options.locals },
+        { "--procedures=", &options.procedures }, { "--nesting=", &options.nesting },
+        { "--expression-depth=", &options.expression_depth }, { "--trip-count=", &options.trip_count },
+        { "--loop-depth=", &options.loop_depth }, { "--loops=", &options.loops },
+        { "--prints=", &options.prints }, { "--reads=", &options.reads }
+    };
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool known = true;
+        if (arg.rfind("--seed=", 0) == 0)
+            options.seed = stoul(arg.substr(7));
+        else if (arg.rfind("--lines=", 0) == 0)
+            options.lines = stoll(arg.substr(8));
+        else if (arg.rfind("--input=", 0) == 0)
+            options.input = arg.substr(8);
+        else
+        {
+            known = false;
+            for (auto& number : numbers)
+            {
+                if (arg.rfind(number.first, 0) == 0)
+                {
+                    *number.second = max(0, stoi(arg.substr(number.first.size())));
+                    known = true;
+                }
+            }
+        }
+        if (!known)
+        {
+            cout << "ERROR:: Unknown option '" << arg << "', expected --seed, --lines, --variables, --locals, --procedures, --nesting,"
+                 << " --expression-depth, --trip-count, --loop-depth, --loops, --prints, --reads or --input" << endl;
+            return 10;
+        }
+    }
+    //Expressions need a variable of each type and a loop nothing inside it can outgrow
+    options.variables = max(2, options.variables);
+    options.nesting = max(1, options.nesting);
+    if (options.loops + options.prints + options.reads > 100)
+    {
+        cout << "ERROR:: --loops, --prints and --reads add up to more than 100 percent" << endl;
+        return 10;
+    }
+
+    ios::sync_with_stdio(false);
+    ProgramGenerator generator(options, cout);
+    generator.generate();
+    cout.flush();
+
+    if (!options.input.empty())
+    {
+        ofstream input(options.input);
+        if (!input)
+        {
+            cout << "ERROR:: Could not open file '" << options.input << "'" << endl;
+            return 10;
+        }
+        generator.write_input(input);
+    }
+    cerr << "Generated " << generator.lines << " lines, " << options.procedures << " procedures, the program READs "
+         << (long long)generator.read_values << " values" << endl;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "output.h"
+#include <charconv>
+
+/* ###############################
+   #        INPUT                #
+   ###############################
+*/
+
+/*
+   READ takes its numbers from here. Standard input is read in large chunks into a
+   buffer that is reused for the whole run, and each whitespace separated token is
+   parsed in place with from_chars, so reading a value neither allocates nor goes
+   through iostreams. A token containing a '.' is a REAL, anything else an INTEGER,
+   and trailing characters after the number are ignored, as stoi/stof did before.
+   PRINT output of the same run that is still buffered is written out before the reader
+   blocks on more input, so prompts appear before the program waits for an answer.
+*/
+class InputReader
+{
+    int fd;
+    Printer* output;    //flushed before waiting for input
+    vector<char> buffer;
+    size_t pos;         //next unread character
+    size_t end;         //one past the last character read so far
+    bool at_eof;
+
+public:
+    size_t bytes_read;
+
+    InputReader(int fd = 0, Printer* output = NULL, size_t chunk_size = 64 * 1024)
+    {
+        this->fd = fd;
+        this->output = output;
+        this->buffer.resize(chunk_size);
+        this->pos = this->end = 0;
+        this->at_eof = false;
+        this->bytes_read = 0;
+    }
+
+    [[noreturn]] void error(string message)
+    {
+        fail(message);
+    }
+
+    Value read_value()
+    {
+        //Skip the whitespace in front of the token
+        while (true)
+        {
+            while (pos < end && isspace((unsigned char)buffer[pos]))
+                pos++;
+            if (pos < end)
+                break;
+            pos = end = 0;
+            if (!refill())
+                error("READ reached the end of the input.");
+        }
+
+        //Scan to the end of the token, keeping it whole across refills
+        size_t token_end = pos;
+        while (true)
+        {
+            while (token_end < end && !isspace((unsigned char)buffer[token_end]))
+                token_end++;
+            if (token_end < end)
+                break;
+            size_t scanned = token_end - pos;
+            memmove(buffer.data(), buffer.data() + pos, end - pos);
+            end -= pos;
+            pos = 0;
+            token_end = scanned;
+            if (!refill())
+                break;
+        }
+
+        const char* first = buffer.data() + pos;
+        const char* last = buffer.data() + token_end;
+        pos = token_end;
+        return parse_number(first, last);
+    }
+
+private:
+    Value parse_number(const char* first, const char* last)
+    {
+        const char* start = first;
+        if (start[0] == '+' && last - start > 1 && start[1] != '-')
+            start++;
+
+        bool real = memchr(first, '.', last - first) != NULL;
+        int integer = 0;
+        float fraction = 0;
+        from_chars_result result = real ? from_chars(start, last, fraction, chars_format::general)
+                                        : from_chars(start, last, integer);
+
+        if (result.ec == errc::result_out_of_range)
+            error("READ value '" + string(first, last) + "' is out of range.");
+        else if (result.ec != errc())
+            error("READ expected a number but got '" + string(first, last) + "'.");
+        if (real)
+            return fraction;
+        return integer;
+    }
+
+    //Appends the next chunk of input after end, growing the buffer if a token fills it
+    bool refill()
+    {
+        if (at_eof)
+            return false;
+        if (output)
+            output->flush();
+        if (end == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        long count = read_chunk(fd, buffer.data() + end, buffer.size() - end);
+        if (count <= 0)
+        {
+            at_eof = true;
+            return false;
+        }
+        end += count;
+        bytes_read += count;
+        return true;
+    }
+};
+
+/*
+   What one run of a program reads and writes. Every engine is handed the context of the
+   run it executes rather than going to cout and stdin itself, so programs running at
+   the same time in different threads share nothing.
+*/
+class RunContext
+{
+
+public:
+    Printer output;
+    InputReader input;
+
+    RunContext(streambuf* output, int input_fd) : output(output), input(input_fd, &this->output) {}
+
+    RunContext(const RunContext&) = delete;
+    RunContext& operator=(const RunContext&) = delete;
+};
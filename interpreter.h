@@ -1,93 +1,118 @@
+#pragma once
 #include "symbol.h"
-#include <stack>
+#include "frame.h"
+#include "jit.h"
+#include "input.h"
+#include "profiler.h"
+#include <climits>
+#include <cmath>
 
 /* ###############################
    #       INTERPRETER           #
    ###############################
 */
 
-class ARType
-{
-public:
-    string PROGRAM = "PROGRAM";
-    string PROCEDURE = "PROCEDURE";
-};
+/* ###############################
+   #    ARITHMETIC KERNELS       #
+   ###############################
+*/
 
-class ActivationRecord 
+//Shared by every execution engine so that INTEGER/REAL behaviour stays identical
+Value add_values(const Value& left, const Value& right)
 {
-public:
-    string name;
-    string type;
-    int nestingLevel;
-    unordered_map<string, typevar> members;
-    unordered_map<string, string> declarations;
-
-    ActivationRecord()
-    {
-        this->nestingLevel = 0;
-    }
-
-    ActivationRecord(string name, string type, int nestingLevel) 
-    {
-        this->name = name;
-        this->type = type;
-        this->nestingLevel = nestingLevel;
-    }
+    if (left.which() == 1 || right.which() == 1) //means one of the is float
+        return left.as_float() + right.as_float();
+    else
+        return left.as_int() + right.as_int();
+}
 
-    void setItem(string key, typevar value)
-    {
-        members[key] = value;
-    }
-
-    typevar getItem(string key)
-    {
-        return members[key];
-    }
-};
+Value subtract_values(const Value& left, const Value& right)
+{
+    if (left.which() == 1 || right.which() == 1)
+        return left.as_float() - right.as_float();
+    else
+        return left.as_int() - right.as_int();
+}
 
-class CallStack 
+Value multiply_values(const Value& left, const Value& right)
+{
+    if (left.which() == 1 || right.which() == 1)
+        return left.as_float() * right.as_float();
+    else
+        return left.as_int() * right.as_int();
+}
+
+//INTEGER division fails rather than trap, which would end every run in the process
+int divide_ints(int left, int right)
 {
+    if (right == 0 || (right == -1 && left == INT_MIN))
+        fail(division_error(right));
+    return left / right;
+}
 
-public:
-    stack<ActivationRecord*> records;
+Value integer_divide_values(const Value& left, const Value& right)
+{
+    if (left.which() == 1 || right.which() == 1)
+        return int(left.as_float() / right.as_float());
+    else
+        return divide_ints(left.as_int(), right.as_int());
+}
 
-    void push(ActivationRecord* ar)
-    {
-        this->records.push(ar);
-    }
+Value float_divide_values(const Value& left, const Value& right)
+{
+    if (left.which() == 1 || right.which() == 1)
+        return left.as_float() / right.as_float();
+    else
+        return divide_ints(left.as_int(), right.as_int());
+}
 
-    ActivationRecord* pop()
-    {
-        ActivationRecord* element = records.top();
-        records.pop();
-        return element;
-    }
+Value power_values(const Value& left, const Value& right)
+{
+    if (left.which() == 1 || right.which() == 1)
+        return int(pow(left.as_float(), right.as_int()) + 0.5);
+    else
+        return int(pow(left.as_int(), right.as_int()) + 0.5);
+}
 
-    ActivationRecord* peek()
-    {
-        return records.top();
-    } 
-};
+Value negate_value(const Value& val)
+{
+    if (val.which() == 0) return -1 * val.as_int();
+    else return -1 * val.as_float();
+}
 
+//Conditions are true for any non zero number, strings are never true
+bool is_truthy(const Value& val)
+{
+    return (val.which() == 1 && val.as_float() != 0) ||
+        (val.which() == 0 && val.as_int() != 0);
+}
 
 class Interpreter
 {
     boostvar tree;
-    CallStack call_stack;
+    RunContext* context; //where READ and PRINT go
+    FrameStack frames;
+    Jit* jit; //hot loops and procedures run as native code when set
+    ProcedureSymbol* tail_call; //callee of a tail call, waiting for its caller's frame to be popped
+    Profiler* profiler; //times statements and procedures when set
 
 public:
-    Interpreter(boostvar tree)
+    Interpreter(boostvar tree, RunContext* context, Jit* jit = NULL, int max_depth = DEFAULT_MAX_DEPTH, Profiler* profiler = NULL)
     {
         this->tree = tree;
+        this->context = context;
+        this->jit = jit;
+        this->tail_call = NULL;
+        this->profiler = profiler;
+        this->frames.max_depth = max_depth;
     }
 
-    void error()
+    [[noreturn]] void error()
     {
-        cout << "ERROR:: No such parsing method present\n";
-        _Exit(10);
+        fail("No such parsing method present");
     }
 
-    typevar visit(boostvar node)
+    Value visit(boostvar node)
     {
         if (node.which() == 0)
             return visit_BinOp(boost::get<BinOp*>(node));
@@ -125,251 +150,335 @@ public:
             return visit_Loop(boost::get<Loop*>(node));
         else if (node.which() == 21)
             return visit_Message(boost::get<Message*>(node));
+        else if (node.which() == 22)
+            return visit_Invariant(boost::get<Invariant*>(node));
         else
             error();
     }
 
-    typevar visit_BinOp(BinOp* node)
+    Value visit_BinOp(BinOp* node)
     {
-        typevar left = visit(node->left);
-        typevar right = visit(node->right);
+        if (node->type == INT_TYPE)
+            return eval_int(node);
+        if (node->type == FLOAT_TYPE)
+            return eval_float(node);
+
+        Value left = visit(node->left);
+        Value right = visit(node->right);
 
-        if (node->op.type == PLUS)
+        switch (node->op.type)
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return boost::get<float>(left) + boost::get<float>(right);
-            else
-                return boost::get<int>(left) + boost::get<int>(right);
+        case PLUS:
+            return add_values(left, right);
+        case MINUS:
+            return subtract_values(left, right);
+        case MUL:
+            return multiply_values(left, right);
+        case INTEGER_DIV:
+            return integer_divide_values(left, right);
+        case FLOAT_DIV:
+            return float_divide_values(left, right);
+        default:
+            return power_values(left, right);
         }
-        else if (node->op.type == MINUS)
+    }
+
+    Value visit_Num(Num* node)
+    {
+        return node->constant;
+    }
+
+    Value visit_UnaryOp(UnaryOp* node)
+    {
+        if (node->type == INT_TYPE)
+            return eval_int(node);
+        if (node->type == FLOAT_TYPE)
+            return eval_float(node);
+
+        Value val = visit(node->expr);
+        if (node->op.type == MINUS)
+            return negate_value(val);
+        return val;
+    }
+
+    /*
+       Type-specialized evaluation for expressions the SemanticAnalyzer typed as INTEGER
+       or REAL: operands are never boxed and no operation checks which() again.
+    */
+    int eval_int(boostvar node)
+    {
+        switch (node.which())
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return boost::get<float>(left) - boost::get<float>(right);
-            else
-                return boost::get<int>(left) - boost::get<int>(right);
-        }
-        else if (node->op.type == MUL)
+        case 0:
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return boost::get<float>(left) * boost::get<float>(right);
-            else
-                return boost::get<int>(left) * boost::get<int>(right);
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            if (static_type(bin_op->left) == FLOAT_TYPE)
+            {
+                //REAL DIV REAL, or a REAL base raised to an INTEGER power
+                float left = eval_float(bin_op->left);
+                if (bin_op->op.type == POW)
+                    return int(pow(left, eval_int(bin_op->right)) + 0.5);
+                return int(left / eval_float(bin_op->right));
+            }
+            int left = eval_int(bin_op->left);
+            int right = eval_int(bin_op->right);
+            switch (bin_op->op.type)
+            {
+            case PLUS: return left + right;
+            case MINUS: return left - right;
+            case MUL: return left * right;
+            case INTEGER_DIV:
+            case FLOAT_DIV: return divide_ints(left, right);
+            default: return int(pow(left, right) + 0.5);
+            }
         }
-        else if (node->op.type == INTEGER_DIV)
+        case 1:
+            return boost::get<Num*>(node)->constant.as_int();
+        case 2:
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return int(boost::get<float>(left) / boost::get<float>(right));
-            else
-                return boost::get<int>(left) / boost::get<int>(right);
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            int value = eval_int(unary_op->expr);
+            return unary_op->op.type == MINUS ? -1 * value : value;
+        }
+        case 5:
+            return load_variable(boost::get<Var*>(node)).as_int();
+        default:
+            return visit(node).as_int();
         }
-        else if (node->op.type == FLOAT_DIV)
+    }
+
+    float eval_float(boostvar node)
+    {
+        switch (node.which())
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return boost::get<float>(left) / boost::get<float>(right);
-            else
-                return boost::get<int>(left) / boost::get<int>(right);
+        case 0:
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            float left = eval_float(bin_op->left);
+            float right = eval_float(bin_op->right);
+            switch (bin_op->op.type)
+            {
+            case PLUS: return left + right;
+            case MINUS: return left - right;
+            case MUL: return left * right;
+            default: return left / right;
+            }
         }
-        else if (node->op.type == POW)
+        case 1:
+            return boost::get<Num*>(node)->constant.as_float();
+        case 2:
         {
-            if (left.which() == 1 || right.which() == 1) //means one of the is float
-                return int(pow(boost::get<float>(left), boost::get<int>(right)) + 0.5);
-            else
-                return int(pow(boost::get<int>(left), boost::get<int>(right)) + 0.5);
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            float value = eval_float(unary_op->expr);
+            return unary_op->op.type == MINUS ? -1 * value : value;
+        }
+        case 5:
+            return load_variable(boost::get<Var*>(node)).as_float();
+        default:
+            return visit(node).as_float();
         }
     }
 
-    typevar visit_Num(Num* node)
+    bool condition_holds(boostvar node)
     {
-        if (node->token.type == INTEGER_CONST)
-            return stoi(node->value);
-        else if(node->token.type == REAL_CONST)
-            return stof(node->value);
-        else
-        {
-            cout << "ERROR:: Invalid Input" << endl;
-            _Exit(10);
-        }
+        StaticType type = static_type(node);
+        if (type == INT_TYPE)
+            return eval_int(node) != 0;
+        if (type == FLOAT_TYPE)
+            return eval_float(node) != 0;
+        return is_truthy(visit(node));
     }
 
-    typevar visit_UnaryOp(UnaryOp* node)
+    //Statement lists go through here so that --profile can time each statement, expressions are visited directly
+    void execute(vector<boostvar>& statements)
     {
-        typevar val = visit(node->expr);
-        if (node->op.type == PLUS)
+        if (profiler)
         {
-            return val;
+            execute_profiled(statements);
+            return;
         }
-        else if (node->op.type == MINUS)
+        for (auto& statement : statements)
+            visit(statement);
+    }
+
+    void execute_profiled(vector<boostvar>& statements)
+    {
+        for (auto& statement : statements)
         {
-            if (val.which() == 0) return -1 * boost::get<int>(val);
-            else return -1 * boost::get<float>(val);
+            bool timed = Profiler::is_statement(statement);
+            if (timed)
+                profiler->enter_statement(statement);
+            visit(statement);
+            if (timed)
+                profiler->leave_statement();
         }
     }
 
-    typevar visit_Compound(Compound* node)
+    Value visit_Compound(Compound* node)
     {
-        for (auto child : node->children)
-            visit(child);
+        execute(node->children);
         return 0;
     }
 
-    typevar visit_NoOp(NoOp* node)
+    Value visit_NoOp(NoOp*)
     {
         return 0;
     }
 
-    typevar visit_Assign(Assign* node)
+    Value visit_Assign(Assign* node)
     {
-        string var_name = boost::get<Var*>(node->left)->value;
-        ActivationRecord *ar = this->call_stack.peek();
-        typevar val = visit(node->right);
-        
-        if (ar->declarations[var_name] == "INTEGER" && val.which() == 1)
-        {
-            cout << "ERROR:: Incompatible type: variable '" << var_name << "'" << endl;
-            _Exit(10);
-        }
-
-        ar->members[var_name] = val;
+        Value val = visit(node->right);
+        assign_variable(boost::get<Var*>(node->left), node->integer_target, val);
         return 0;
     }
 
-    typevar visit_Message(Message* node)
+    void assign_variable(Var* variable, bool integer_target, Value val)
     {
-        return node->msg;
+        if (integer_target && val.which() == 1)
+            fail("Incompatible type: variable '" + variable->value + "'");
+
+        frames.store(frames.display[variable->depth], variable->slot, val);
     }
 
-    typevar visit_Read(Read* node)
+    Value visit_Message(Message* node)
     {
-        Var* variable = boost::get<Var*>(node->var);
-        string input_value; cin >> input_value;
+        return Value(&node->msg);
+    }
 
-        Num* number;
-        if(input_value.find('.') != string::npos)
-            number = new Num(Token("REAL_CONST", input_value));
-        else
-            number = new Num(Token("INTEGER_CONST", input_value));
-        
-        visit_Assign(new Assign(variable, Token(ASSIGN, ":="), number));
+    Value visit_Read(Read* node)
+    {
+        Var* variable = boost::get<Var*>(node->var);
+        assign_variable(variable, node->integer_target, context->input.read_value());
         return 0;
     }
 
-    typevar visit_Print(Print* node)
+    Value visit_Print(Print* node)
     {
         for (auto message : node->messages)
-        {
-            typevar output = visit(message);
-            if (output.which() == 0) cout << boost::get<int>(output) << " ";
-            else if (output.which() == 1) cout << boost::get<float>(output) << " ";
-            else cout << boost::get<string>(output);
-        }
-        cout << endl;
+            context->output.print_value(visit(message));
+        context->output.print_end();
         
         return 0;
     }
 
-    typevar visit_Condition(Condition* node)
+    Value visit_Condition(Condition* node)
     {
-        typevar condition_value = visit(node->condition_node);
-        if ((condition_value.which() == 1 && boost::get<float>(condition_value) != 0) || 
-            (condition_value.which() == 0 && boost::get<int>(condition_value) != 0))
-        {
-            for (auto statement : node->if_statements)
-                visit(statement);
-        }
+        if (condition_holds(node->condition_node))
+            execute(node->if_statements);
         else
-        {
-            for (auto statement : node->else_statements)
-                visit(statement);
-        }
+            execute(node->else_statements);
         return 0;
     }
 
-    typevar visit_Loop(Loop* node)
+    Value visit_Loop(Loop* node)
     {
-        typevar condition_value = visit(node->condition_node);
-        while ((condition_value.which() == 1 && boost::get<float>(condition_value) != 0) ||
-            (condition_value.which() == 0 && boost::get<int>(condition_value) != 0))
+        int base = frames.top().base;
+        for (int slot : node->invariant_slots)
+            frames.invalidate(base, slot);
+
+        //Every iteration counts towards the loop getting compiled, which then runs the remaining ones
+        JitRegion* region = jit ? jit->region(node) : NULL;
+        while (true)
         {
-            for (auto statement : node->statements)
-                visit(statement);
-            condition_value = visit(node->condition_node);
+            if (region && jit->run(region, node, frames))
+                break;
+            if (!condition_holds(node->condition_node))
+                break;
+            execute(node->statements);
+            frames.loop_iterations++;
         }
         return 0;
     }
 
-    typevar visit_Var(Var* node)
+    Value visit_Invariant(Invariant* node)
     {
-        string var_name = node->value;
-        ActivationRecord* ar = this->call_stack.peek();
-        if (ar->members.find(var_name) == ar->members.end())
-        {
-            cout << "ERROR:: Variable "<< var_name <<" not defined.\n";
-            _Exit(10);
-        }
-        return ar->members[var_name];
+        int base = frames.top().base;
+        if (!frames.assigned[base + node->slot])
+            frames.store(base, node->slot, visit(node->expr));
+        return frames.slots[base + node->slot];
+    }
+
+    Value visit_Var(Var* node)
+    {
+        return load_variable(node);
+    }
+
+    const Value& load_variable(Var* node)
+    {
+        int base = frames.display[node->depth];
+        if (!frames.assigned[base + node->slot])
+            fail("Variable " + node->value + " not defined.");
+        return frames.slots[base + node->slot];
     }
 
-    int visit_Type(Type* node)
+    int visit_Type(Type*)
     {
         return 0;
     }
 
-    int visit_VarDecl(VarDecl* node)
+    int visit_VarDecl(VarDecl*)
     {
-        ActivationRecord* ar = this->call_stack.peek();
-        Var* var = boost::get<Var*>(node->var_node);
-        Type* type_val = boost::get<Type*>(node->type_node);
-        ar->declarations[var->value] = type_val->value;
         return 0;
     }
 
-    int visit_ProcedureDecl(ProcedureDecl* node) {
+    int visit_ProcedureDecl(ProcedureDecl*) {
         return 0;
     }
 
     int visit_ProcedureCall(ProcedureCall* node)
     {
-        string proc_name = node->proc_name;
         ProcedureSymbol* proc_symbol = node->proc_symbol;
-
-        ActivationRecord* parent = this->call_stack.peek();
-
-        ARType ar_type;
-        ActivationRecord* ar = new ActivationRecord(proc_name, ar_type.PROCEDURE, proc_symbol->scope_level+1);
-        
-        vector<boostvar> formal_params = proc_symbol->params;
-        vector<boostvar> actual_params = node->actual_params;
+        vector<boostvar>& formal_params = proc_symbol->params;
+        vector<boostvar>& actual_params = node->actual_params;
 
         if (formal_params.size() != actual_params.size())
         {
             if (formal_params.size() > actual_params.size())
-                cout << "ERROR:: Too few arguments given in the function call." << endl;
-            else
-                cout << "ERROR:: Too many arguments given in the function call." << endl;
-            _Exit(10);
+                fail("Too few arguments given in the function call.");
+            fail("Too many arguments given in the function call.");
         }
 
-        for (int i = 0; i < formal_params.size(); i++)
+        //Arguments are evaluated in the caller's scope, before the callee's frame takes over its display entry
+        vector<Value>& arguments = frames.arguments;
+        for (size_t i = 0; i < formal_params.size(); i++)
         {
-            VarSymbol* var = boost::get<VarSymbol*>(formal_params[i]);
-            string var_name = var->name;
-            typevar val = visit(actual_params[i]);
-            BuiltinTypeSymbol* type_val = boost::get<BuiltinTypeSymbol*>(var->type);
-            if (type_val->name == INTEGER && val.which() == 1)
+            Value val = visit(actual_params[i]);
+            if (node->integer_checks[i] && val.which() == 1)
             {
-                cout << "ERROR:: Incompatible type: variable '" << var_name << "'" << endl;
-                _Exit(10);
+                VarSymbol* var = boost::get<VarSymbol*>(formal_params[i]);
+                fail("Incompatible type: variable '" + var->name + "'");
             }
-
-            ar->members[var_name] = val;
+            arguments.push_back(val);
         }
 
-        for (auto i : parent->members)
-            ar->members[i.first] = i.second;
+        //The procedure running now is left with nothing else to do, the loop below starts the callee
+        if (node->tail_call)
+        {
+            this->tail_call = proc_symbol;
+            return 0;
+        }
 
-        this->call_stack.push(ar);
-        visit(proc_symbol->block_node);
-        this->call_stack.pop();
+        //Tail calls made by the body replace its frame here instead of nesting another call
+        while (proc_symbol)
+        {
+            int first = arguments.size() - proc_symbol->params.size();
+            int base = frames.push(proc_symbol->scope_level + 1, proc_symbol->inherited, proc_symbol->frame_size);
+            for (size_t i = 0; i < proc_symbol->params.size(); i++)
+                frames.store(base, boost::get<VarSymbol*>(proc_symbol->params[i])->slot, arguments[first + i]);
+            arguments.resize(first);
+
+            Block* block = boost::get<Block*>(proc_symbol->block_node);
+            if (profiler)
+                profiler->enter_procedure(proc_symbol);
+            if (!jit || !jit->run(jit->region(block), block->compound_statement, frames))
+                visit(block);
+            if (profiler)
+                profiler->leave_procedure();
+            frames.pop();
+
+            proc_symbol = this->tail_call;
+            this->tail_call = NULL;
+        }
         return 0;
     }
 
@@ -384,16 +493,22 @@ public:
 
     int visit_Program(Program* node)
     {
-        string program_name = node->name;
-        ARType ar_object;
-        ActivationRecord* ar = new ActivationRecord(program_name, ar_object.PROGRAM, 1);
-        this->call_stack.push(ar);
+        frames.push(1, 0, node->frame_size);
+        if (profiler)
+            profiler->enter_program(node);
         visit(node->block);
-        this->call_stack.pop();
+        if (profiler)
+            profiler->leave_procedure();
+        frames.pop();
         return 0;
     }
 
-    typevar interpret()
+    FrameStack& frame_stack()
+    {
+        return frames;
+    }
+
+    Value interpret()
     {
         return visit(tree);
     }
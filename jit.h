@@ -0,0 +1,806 @@
+#pragma once
+#include "symbol.h"
+#include "frame.h"
+#include "input.h"
+#include <cmath>
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+/* ###############################
+   #        NATIVE TIER          #
+   ###############################
+*/
+
+/*
+   Where native code goes when it reads a variable that is not defined or divides by 0.
+   An exception cannot unwind through the generated code, so the helper jumps back to
+   Jit::run, which reports the error from there. Only the generated frames are skipped,
+   none of them has anything to clean up.
+*/
+struct JitEscape
+{
+    jmp_buf target;
+    string message;
+};
+
+//Called from the generated code, they do exactly what the arithmetic kernels and PRINT do
+int jit_pow_int(int base, int exponent)
+{
+    return int(pow(base, exponent) + 0.5);
+}
+
+int jit_pow_float(float base, int exponent)
+{
+    return int(pow(base, exponent) + 0.5);
+}
+
+void jit_print_int(int value, Printer* output)
+{
+    output->print_int(value);
+}
+
+void jit_print_float(float value, Printer* output)
+{
+    output->print_float(value);
+}
+
+void jit_print_end(Printer* output)
+{
+    output->print_end();
+}
+
+void jit_undefined(const string* name, JitEscape* escape)
+{
+    escape->message = "Variable " + *name + " not defined.";
+    longjmp(escape->target, 1);
+}
+
+void jit_division_error(int divisor, JitEscape* escape)
+{
+    escape->message = division_error(divisor);
+    longjmp(escape->target, 1);
+}
+
+typedef void (*NativeCode)(int64_t* cells, char* assigned);
+
+//One loop or procedure body, with the slot types its native code was specialized for
+class JitRegion
+{
+
+public:
+    int executions;
+    bool failed;                //could not be compiled, stays interpreted
+    NativeCode code;
+    size_t code_size;
+    vector<int> used;           //slots the code reads or writes
+    vector<int> levels;         //scope level whose frame holds every used slot
+    vector<StaticType> types;   //type of every used slot
+    vector<int> written;        //slots to copy back into the frame afterwards
+
+    JitRegion()
+    {
+        this->executions = 0;
+        this->failed = false;
+        this->code = NULL;
+        this->code_size = 0;
+    }
+
+    ~JitRegion()
+    {
+#ifdef JIT_SUPPORTED
+        if (code)
+            munmap((void*)code, code_size);
+#endif
+    }
+};
+
+/* ###############################
+   #        ASSEMBLER            #
+   ###############################
+*/
+
+/*
+   Just the x86-64 encodings the code generator needs. Integers live in eax/ecx,
+   REALs in xmm0/xmm1, slot values in [rbx + 8*slot] and the frame's assigned
+   flags in [rbp + slot]; every memory operand uses a 32 bit displacement.
+*/
+class Assembler
+{
+
+public:
+    vector<unsigned char> code;
+
+    void emit(initializer_list<int> bytes)
+    {
+        for (int b : bytes)
+            code.push_back((unsigned char)b);
+    }
+
+    void imm32(int32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            code.push_back((value >> (8 * i)) & 0xFF);
+    }
+
+    void imm64(uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            code.push_back((value >> (8 * i)) & 0xFF);
+    }
+
+    int here()
+    {
+        return code.size();
+    }
+
+    //Emits a jump with a 32 bit displacement to fill in later, returns where the displacement is
+    int jump(initializer_list<int> opcode)
+    {
+        emit(opcode);
+        imm32(0);
+        return code.size() - 4;
+    }
+
+    void jump_to(initializer_list<int> opcode, int target)
+    {
+        emit(opcode);
+        imm32(target - (here() + 4));
+    }
+
+    void bind(int displacement_at)
+    {
+        int32_t relative = here() - (displacement_at + 4);
+        memcpy(&code[displacement_at], &relative, 4);
+    }
+
+    void load_int(int slot)        { emit({ 0x8B, 0x83 }); imm32(8 * slot); }              //mov eax, [rbx+d]
+    void store_int(int slot)       { emit({ 0x89, 0x83 }); imm32(8 * slot); }              //mov [rbx+d], eax
+    void load_float(int slot)      { emit({ 0xF3, 0x0F, 0x10, 0x83 }); imm32(8 * slot); }  //movss xmm0, [rbx+d]
+    void store_float(int slot)     { emit({ 0xF3, 0x0F, 0x11, 0x83 }); imm32(8 * slot); }  //movss [rbx+d], xmm0
+    void set_assigned(int slot, int value) { emit({ 0xC6, 0x85 }); imm32(slot); emit({ value }); } //mov byte [rbp+d], imm8
+    void test_assigned(int slot)   { emit({ 0x80, 0xBD }); imm32(slot); emit({ 0x00 }); }  //cmp byte [rbp+d], 0
+    void increment(int cell)       { emit({ 0x48, 0xFF, 0x83 }); imm32(8 * cell); }        //inc qword [rbx+d]
+    void move_rdi(uint64_t value)  { emit({ 0x48, 0xBF }); imm64(value); }                 //mov rdi, imm64
+    void move_rsi(uint64_t value)  { emit({ 0x48, 0xBE }); imm64(value); }                 //mov rsi, imm64
+
+    void call(void* function)
+    {
+        emit({ 0x48, 0xB8 });   //mov rax, imm64
+        imm64((uint64_t)function);
+        emit({ 0xFF, 0xD0 });   //call rax
+    }
+};
+
+/* ###############################
+   #     NATIVE CODE GENERATOR   #
+   ###############################
+*/
+
+/*
+   Compiles one region for the slot types the frame holds right now. Supported are
+   assignments, IF, WHILE, numeric PRINT and INTEGER/REAL arithmetic whose operand
+   types are known; anything else (READ, calls, strings, operations that would throw
+   on mixed types) makes the region stay interpreted.
+*/
+class NativeCompiler
+{
+    Assembler assembler;
+    vector<StaticType> types;           //per slot of the frame
+    vector<char> used, written;
+    vector<int> levels;                 //scope level of the frame each slot lives in
+    vector<const string*> names;        //for the "not defined" error
+    Printer* output;                    //of the run, passed to the PRINT helpers
+    JitEscape* escape;
+    vector<pair<int, boostvar>> stores; //(slot, value) of every assignment and cached invariant
+    int depth;                          //8 byte values pushed on the machine stack
+    bool supported;
+
+public:
+    NativeCompiler(int frame_size, int level, Printer* output, JitEscape* escape)
+    {
+        this->output = output;
+        this->escape = escape;
+        this->types.assign(frame_size, UNKNOWN_TYPE);
+        this->used.assign(frame_size, 0);
+        this->written.assign(frame_size, 0);
+        this->levels.assign(frame_size, level);
+        this->names.assign(frame_size, NULL);
+        this->depth = 0;
+        this->supported = true;
+    }
+
+    bool compile(boostvar region, FrameStack& frames, JitRegion* result)
+    {
+        collect(region);
+        if (!supported)
+            return false;
+
+        for (int slot = 0; slot < (int)types.size(); slot++)
+        {
+            int index = frames.display[levels[slot]] + slot;
+            if (used[slot] && types[slot] == UNKNOWN_TYPE && frames.assigned[index])
+                types[slot] = frames.slots[index].which() == 0 ? INT_TYPE : FLOAT_TYPE;
+        }
+        infer_stored_types();
+
+        //prologue: push rbx; push rbp; sub rsp, 8; mov rbx, rdi; mov rbp, rsi
+        assembler.emit({ 0x53, 0x55, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xFB, 0x48, 0x89, 0xF5 });
+        statement(region);
+        //epilogue: add rsp, 8; pop rbp; pop rbx; ret
+        assembler.emit({ 0x48, 0x83, 0xC4, 0x08, 0x5D, 0x5B, 0xC3 });
+        if (!supported)
+            return false;
+
+        for (int slot = 0; slot < (int)types.size(); slot++)
+        {
+            if (!used[slot])
+                continue;
+            result->used.push_back(slot);
+            result->levels.push_back(levels[slot]);
+            result->types.push_back(types[slot]);
+            if (written[slot])
+                result->written.push_back(slot);
+        }
+        result->code = (NativeCode)install();
+        result->code_size = assembler.code.size();
+        return result->code != NULL;
+    }
+
+private:
+    void collect(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 0:
+            collect(boost::get<BinOp*>(node)->left);
+            collect(boost::get<BinOp*>(node)->right);
+            break;
+        case 1:
+        case 6:
+            break;
+        case 2:
+            collect(boost::get<UnaryOp*>(node)->expr);
+            break;
+        case 3:
+            for (auto child : boost::get<Compound*>(node)->children)
+                collect(child);
+            break;
+        case 4:
+        {
+            Assign* assign = boost::get<Assign*>(node);
+            Var* target = boost::get<Var*>(assign->left);
+            use(target);
+            written[target->slot] = 1;
+            stores.push_back({ target->slot, assign->right });
+            collect(assign->right);
+            break;
+        }
+        case 5:
+            use(boost::get<Var*>(node));
+            break;
+        case 16:
+            for (auto message : boost::get<Print*>(node)->messages)
+                collect(message);
+            break;
+        case 19:
+        {
+            Condition* condition = boost::get<Condition*>(node);
+            collect(condition->condition_node);
+            for (auto child : condition->if_statements)
+                collect(child);
+            for (auto child : condition->else_statements)
+                collect(child);
+            break;
+        }
+        case 20:
+        {
+            Loop* loop = boost::get<Loop*>(node);
+            for (int slot : loop->invariant_slots)
+            {
+                used[slot] = 1;
+                written[slot] = 1;
+            }
+            collect(loop->condition_node);
+            for (auto child : loop->statements)
+                collect(child);
+            break;
+        }
+        case 22:
+        {
+            Invariant* invariant = boost::get<Invariant*>(node);
+            used[invariant->slot] = 1;
+            written[invariant->slot] = 1;
+            stores.push_back({ invariant->slot, invariant->expr });
+            collect(invariant->expr);
+            break;
+        }
+        default:
+            supported = false; //READ, procedure calls, string messages
+        }
+    }
+
+    void use(Var* var)
+    {
+        used[var->slot] = 1;
+        levels[var->slot] = var->depth;
+        names[var->slot] = &var->value;
+        if (var->type == INT_TYPE || var->type == FLOAT_TYPE)
+            types[var->slot] = var->type;
+    }
+
+    //Slots without a value yet get the type of what is stored into them
+    void infer_stored_types()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto& store : stores)
+            {
+                StaticType type = type_of(store.second);
+                if (type == UNKNOWN_TYPE)
+                    continue;
+                if (types[store.first] == UNKNOWN_TYPE)
+                {
+                    types[store.first] = type;
+                    changed = true;
+                }
+                else if (types[store.first] != type)
+                    supported = false; //e.g. an INTEGER target given a REAL, which is an error
+            }
+        }
+        //Never stored and not set on entry, so reading it can only raise "not defined"
+        for (int slot = 0; slot < (int)types.size(); slot++)
+        {
+            if (used[slot] && types[slot] == UNKNOWN_TYPE)
+                types[slot] = INT_TYPE;
+        }
+    }
+
+    StaticType type_of(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 0:
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            StaticType left = type_of(bin_op->left), right = type_of(bin_op->right);
+            if (left == UNKNOWN_TYPE || right == UNKNOWN_TYPE)
+                return UNKNOWN_TYPE;
+            if (bin_op->op.type == POW)
+                return right == INT_TYPE ? INT_TYPE : UNKNOWN_TYPE;
+            if (left != right)
+                return UNKNOWN_TYPE;
+            return bin_op->op.type == INTEGER_DIV ? INT_TYPE : left;
+        }
+        case 1:
+            return boost::get<Num*>(node)->constant.which() == 0 ? INT_TYPE : FLOAT_TYPE;
+        case 2:
+            return type_of(boost::get<UnaryOp*>(node)->expr);
+        case 5:
+            return types[boost::get<Var*>(node)->slot];
+        case 22:
+            return type_of(boost::get<Invariant*>(node)->expr);
+        default:
+            return UNKNOWN_TYPE;
+        }
+    }
+
+    void* install()
+    {
+#ifdef JIT_SUPPORTED
+        size_t size = assembler.code.size();
+        void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return NULL;
+        memcpy(memory, assembler.code.data(), size);
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, size);
+            return NULL;
+        }
+        return memory;
+#else
+        return NULL;
+#endif
+    }
+
+    void call(void* function)
+    {
+        //the stack is 16 byte aligned when nothing is pushed
+        if (depth % 2)
+            assembler.emit({ 0x48, 0x83, 0xEC, 0x08 });
+        assembler.call(function);
+        if (depth % 2)
+            assembler.emit({ 0x48, 0x83, 0xC4, 0x08 });
+    }
+
+    void push(StaticType type)
+    {
+        if (type == INT_TYPE)
+            assembler.emit({ 0x50 });                                               //push rax
+        else
+            assembler.emit({ 0x48, 0x83, 0xEC, 0x08, 0xF3, 0x0F, 0x11, 0x04, 0x24 }); //sub rsp, 8; movss [rsp], xmm0
+        depth++;
+    }
+
+    //Moves the right operand to ecx/xmm1 and pops the left one into eax/xmm0
+    void pop_operands(StaticType left, StaticType right)
+    {
+        if (right == INT_TYPE)
+            assembler.emit({ 0x89, 0xC1 });         //mov ecx, eax
+        else
+            assembler.emit({ 0x0F, 0x28, 0xC8 });   //movaps xmm1, xmm0
+        if (left == INT_TYPE)
+            assembler.emit({ 0x58 });               //pop rax
+        else
+            assembler.emit({ 0xF3, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08 }); //movss xmm0, [rsp]; add rsp, 8
+        depth--;
+    }
+
+    void load(Var* var)
+    {
+        int slot = var->slot;
+        assembler.test_assigned(slot);
+        int defined = assembler.jump({ 0x0F, 0x85 });  //jne
+        assembler.move_rdi((uint64_t)names[slot]);
+        assembler.move_rsi((uint64_t)escape);
+        call((void*)jit_undefined);
+        assembler.bind(defined);
+        if (types[slot] == INT_TYPE)
+            assembler.load_int(slot);
+        else
+            assembler.load_float(slot);
+    }
+
+    void store(int slot, StaticType type)
+    {
+        if (type != types[slot])
+            supported = false;
+        if (type == INT_TYPE)
+            assembler.store_int(slot);
+        else
+            assembler.store_float(slot);
+        assembler.set_assigned(slot, 1);
+    }
+
+    //Jumps when the value of the given type in eax/xmm0 is not truthy, returns the jump to bind
+    int jump_if_false(StaticType type)
+    {
+        if (type == INT_TYPE)
+        {
+            assembler.emit({ 0x85, 0xC0 });                         //test eax, eax
+            return assembler.jump({ 0x0F, 0x84 });                  //je
+        }
+        assembler.emit({ 0x0F, 0x57, 0xC9, 0x0F, 0x2E, 0xC1 });     //xorps xmm1, xmm1; ucomiss xmm0, xmm1
+        int unordered = assembler.jump({ 0x0F, 0x8A });             //jp: NaN is truthy
+        int to_false = assembler.jump({ 0x0F, 0x84 });              //je
+        assembler.bind(unordered);
+        return to_false;
+    }
+
+    void statements(vector<boostvar>& nodes)
+    {
+        for (auto node : nodes)
+            statement(node);
+    }
+
+    void statement(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 3:
+            statements(boost::get<Compound*>(node)->children);
+            break;
+        case 4:
+        {
+            Assign* assign = boost::get<Assign*>(node);
+            store(boost::get<Var*>(assign->left)->slot, expression(assign->right));
+            break;
+        }
+        case 16:
+            for (auto message : boost::get<Print*>(node)->messages)
+            {
+                StaticType type = expression(message);
+                if (type == INT_TYPE)
+                {
+                    assembler.emit({ 0x89, 0xC7 }); //mov edi, eax
+                    assembler.move_rsi((uint64_t)output);
+                    call((void*)jit_print_int);
+                }
+                else
+                {
+                    assembler.move_rdi((uint64_t)output);
+                    call((void*)jit_print_float);
+                }
+            }
+            assembler.move_rdi((uint64_t)output);
+            call((void*)jit_print_end);
+            break;
+        case 19:
+        {
+            Condition* condition = boost::get<Condition*>(node);
+            int to_else = jump_if_false(expression(condition->condition_node));
+            statements(condition->if_statements);
+            int to_end = assembler.jump({ 0xE9 });
+            assembler.bind(to_else);
+            statements(condition->else_statements);
+            assembler.bind(to_end);
+            break;
+        }
+        case 20:
+        {
+            Loop* loop = boost::get<Loop*>(node);
+            for (int slot : loop->invariant_slots)
+                assembler.set_assigned(slot, 0);
+            int start = assembler.here();
+            int to_end = jump_if_false(expression(loop->condition_node));
+            statements(loop->statements);
+            assembler.increment(types.size()); //the cell after the frame's slots counts iterations
+            assembler.jump_to({ 0xE9 }, start);
+            assembler.bind(to_end);
+            break;
+        }
+        }
+    }
+
+    StaticType expression(boostvar node)
+    {
+        StaticType type = type_of(node);
+        if (type == UNKNOWN_TYPE)
+        {
+            supported = false;
+            return INT_TYPE;
+        }
+
+        switch (node.which())
+        {
+        case 0:
+            binary(boost::get<BinOp*>(node));
+            break;
+        case 1:
+        {
+            Value constant = boost::get<Num*>(node)->constant;
+            if (type == INT_TYPE)
+            {
+                assembler.emit({ 0xB8 });                       //mov eax, imm32
+                assembler.imm32(constant.as_int());
+            }
+            else
+            {
+                float value = constant.as_float();
+                int32_t bits;
+                memcpy(&bits, &value, 4);
+                assembler.emit({ 0xB8 });
+                assembler.imm32(bits);
+                assembler.emit({ 0x66, 0x0F, 0x6E, 0xC0 });     //movd xmm0, eax
+            }
+            break;
+        }
+        case 2:
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            expression(unary_op->expr);
+            if (unary_op->op.type == MINUS)
+            {
+                if (type == INT_TYPE)
+                    assembler.emit({ 0x6B, 0xC0, 0xFF });       //imul eax, eax, -1
+                else
+                {
+                    //-1*x rather than flipping the sign bit, so NaNs print the same
+                    assembler.emit({ 0xB9 });                   //mov ecx, -1.0f
+                    assembler.imm32(0xBF800000);
+                    assembler.emit({ 0x66, 0x0F, 0x6E, 0xC9, 0xF3, 0x0F, 0x59, 0xC1 }); //movd xmm1, ecx; mulss xmm0, xmm1
+                }
+            }
+            break;
+        }
+        case 5:
+            load(boost::get<Var*>(node));
+            break;
+        case 22:
+        {
+            Invariant* invariant = boost::get<Invariant*>(node);
+            assembler.test_assigned(invariant->slot);
+            int cached = assembler.jump({ 0x0F, 0x85 });        //jne
+            store(invariant->slot, expression(invariant->expr));
+            int to_end = assembler.jump({ 0xE9 });
+            assembler.bind(cached);
+            if (type == INT_TYPE)
+                assembler.load_int(invariant->slot);
+            else
+                assembler.load_float(invariant->slot);
+            assembler.bind(to_end);
+            break;
+        }
+        }
+        return type;
+    }
+
+    //eax / ecx, escaping where idiv would trap: a divisor of 0, or INT_MIN / -1
+    void divide()
+    {
+        assembler.emit({ 0x85, 0xC9 });                         //test ecx, ecx
+        int by_zero = assembler.jump({ 0x0F, 0x84 });           //je
+        assembler.emit({ 0x83, 0xF9, 0xFF });                   //cmp ecx, -1
+        int divisor_ok = assembler.jump({ 0x0F, 0x85 });        //jne
+        assembler.emit({ 0x3D, 0x00, 0x00, 0x00, 0x80 });       //cmp eax, INT_MIN
+        int dividend_ok = assembler.jump({ 0x0F, 0x85 });       //jne
+        assembler.bind(by_zero);
+        assembler.emit({ 0x89, 0xCF });                         //mov edi, ecx
+        assembler.move_rsi((uint64_t)escape);
+        call((void*)jit_division_error);
+        assembler.bind(divisor_ok);
+        assembler.bind(dividend_ok);
+        assembler.emit({ 0x99, 0xF7, 0xF9 });                   //cdq; idiv ecx
+    }
+
+    void binary(BinOp* node)
+    {
+        StaticType left = expression(node->left);
+        push(left);
+        StaticType right = expression(node->right);
+        pop_operands(left, right);
+
+        if (node->op.type == POW)
+        {
+            if (left == INT_TYPE)
+            {
+                assembler.emit({ 0x89, 0xC7, 0x89, 0xCE });    //mov edi, eax; mov esi, ecx
+                call((void*)jit_pow_int);
+            }
+            else
+            {
+                assembler.emit({ 0x89, 0xCF });                //mov edi, ecx
+                call((void*)jit_pow_float);
+            }
+            return;
+        }
+
+        if (left == INT_TYPE)
+        {
+            switch (node->op.type)
+            {
+            case PLUS: assembler.emit({ 0x01, 0xC8 }); break;              //add eax, ecx
+            case MINUS: assembler.emit({ 0x29, 0xC8 }); break;             //sub eax, ecx
+            case MUL: assembler.emit({ 0x0F, 0xAF, 0xC1 }); break;         //imul eax, ecx
+            default: divide(); break;
+            }
+            return;
+        }
+
+        switch (node->op.type)
+        {
+        case PLUS: assembler.emit({ 0xF3, 0x0F, 0x58, 0xC1 }); break;      //addss xmm0, xmm1
+        case MINUS: assembler.emit({ 0xF3, 0x0F, 0x5C, 0xC1 }); break;     //subss xmm0, xmm1
+        case MUL: assembler.emit({ 0xF3, 0x0F, 0x59, 0xC1 }); break;       //mulss xmm0, xmm1
+        case FLOAT_DIV: assembler.emit({ 0xF3, 0x0F, 0x5E, 0xC1 }); break; //divss xmm0, xmm1
+        default:
+            assembler.emit({ 0xF3, 0x0F, 0x5E, 0xC1, 0xF3, 0x0F, 0x2C, 0xC0 }); //divss; cvttss2si eax, xmm0
+        }
+    }
+};
+
+/*
+   Counts how often every loop and procedure body runs and, once one passes the
+   threshold, compiles it to native code for the slot types its frame holds. A
+   compiled region is only entered when the frame still holds those types; values
+   are unboxed into a flat array for the native code and boxed back afterwards.
+*/
+class Jit
+{
+    int threshold;
+    RunContext* context;
+    JitEscape escape;
+    unordered_map<void*, JitRegion*> regions;
+    vector<int64_t> cells;
+    vector<char> flags;     //assigned bytes of the used slots while native code runs
+
+public:
+    int compiled;
+
+    Jit(RunContext* context, int threshold = 1000)
+    {
+        this->context = context;
+        this->threshold = threshold;
+        this->compiled = 0;
+    }
+
+    ~Jit()
+    {
+        for (auto& entry : regions)
+            delete entry.second;
+    }
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    JitRegion* region(void* node)
+    {
+        JitRegion*& region = regions[node];
+        if (region == NULL)
+            region = new JitRegion();
+        return region;
+    }
+
+    //Runs code natively when it is hot and compiled, returns false when it must be interpreted
+    bool run(JitRegion* region, boostvar code, FrameStack& frames)
+    {
+        FrameRecord& current = frames.top();
+        if (region->code == NULL)
+        {
+            if (region->failed || ++region->executions < threshold)
+                return false;
+            NativeCompiler compiler(current.frame_size, current.level, &context->output, &escape);
+            if (!compiler.compile(code, frames, region))
+            {
+                region->failed = true;
+                return false;
+            }
+            compiled++;
+        }
+
+        //Slots of enclosing scopes live in their own frames, gather them next to the local ones
+        for (size_t i = 0; i < region->used.size(); i++)
+        {
+            int index = frames.display[region->levels[i]] + region->used[i];
+            if (frames.assigned[index] && frames.slots[index].which() != (region->types[i] == INT_TYPE ? 0 : 1))
+                return false;
+        }
+
+        if ((int)cells.size() < current.frame_size + 1)
+        {
+            cells.resize(current.frame_size + 1);
+            flags.resize(current.frame_size);
+        }
+        cells[current.frame_size] = 0;
+        for (size_t i = 0; i < region->used.size(); i++)
+        {
+            int slot = region->used[i];
+            int index = frames.display[region->levels[i]] + slot;
+            flags[slot] = frames.assigned[index];
+            if (!flags[slot])
+                continue;
+            if (region->types[i] == INT_TYPE)
+                memcpy(&cells[slot], &frames.slots[index].as_int(), 4);
+            else
+                memcpy(&cells[slot], &frames.slots[index].as_float(), 4);
+        }
+
+        if (setjmp(escape.target) != 0)
+            fail(escape.message);
+        region->code(cells.data(), flags.data());
+        frames.loop_iterations += cells[current.frame_size];
+
+        for (size_t i = 0, j = 0; i < region->used.size(); i++)
+        {
+            int slot = region->used[i];
+            int index = frames.display[region->levels[i]] + slot;
+            frames.assigned[index] = flags[slot];
+            if (j == region->written.size() || slot != region->written[j])
+                continue;
+            j++;
+            if (!flags[slot])
+                continue;
+            if (region->types[i] == INT_TYPE)
+            {
+                int value;
+                memcpy(&value, &cells[slot], 4);
+                frames.slots[index] = value;
+            }
+            else
+            {
+                float value;
+                memcpy(&value, &cells[slot], 4);
+                frames.slots[index] = value;
+            }
+        }
+        return true;
+    }
+};
@@ -8,6 +8,20 @@
 #include <unordered_map>
 #include <boost/variant.hpp>
 #include <stack>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <type_traits>
+#include <sstream>
+#include "error.h"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 using namespace std;
 
 class BinOp;
@@ -32,143 +46,430 @@ class ProcedureCall;
 class Condition;
 class Loop;
 class Message;
+class Invariant;
 
-#define boostvar boost::variant<BinOp*, Num*, UnaryOp*, Compound*, Assign*, Var*, NoOp*, Program*, Block*, VarDecl*, Type*, BuiltinTypeSymbol*, VarSymbol*, ProcedureDecl*, Param*, ProcedureSymbol*, Print*, ProcedureCall*, Read*, Condition*, Loop*, Message*>
-#define typevar boost::variant<int, float, string>
+#define boostvar boost::variant<BinOp*, Num*, UnaryOp*, Compound*, Assign*, Var*, NoOp*, Program*, Block*, VarDecl*, Type*, BuiltinTypeSymbol*, VarSymbol*, ProcedureDecl*, Param*, ProcedureSymbol*, Print*, ProcedureCall*, Read*, Condition*, Loop*, Message*, Invariant*>
 
-unordered_map<string, float> GLOBAL_SCOPE;
+/* ###############################
+   #        VALUES               #
+   ###############################
+*/
+
+/*
+   Result of every expression: an INTEGER, a REAL or the text of a PRINT message.
+   Strings are never built while a program runs, so a value only points at the text its
+   Message node owns. That keeps it at 16 bytes and trivially copyable, cheap to pass
+   around by value in frames, operand stacks and visit results.
+*/
+class Value
+{
+    int tag; //0 for INTEGER, 1 for REAL, 2 for strings
+    union
+    {
+        int integer;
+        float real;
+        const string* text;
+    };
+
+    void check(int expected) const
+    {
+        //Same failure as reading the wrong alternative of a boost::variant
+        if (tag != expected)
+            boost::throw_exception(boost::bad_get());
+    }
+
+public:
+    Value()
+    {
+        this->tag = 0;
+        this->integer = 0;
+    }
+
+    Value(int value)
+    {
+        this->tag = 0;
+        this->integer = value;
+    }
+
+    Value(float value)
+    {
+        this->tag = 1;
+        this->real = value;
+    }
+
+    explicit Value(const string* text)
+    {
+        this->tag = 2;
+        this->text = text;
+    }
+
+    int which() const { return tag; }
+
+    int& as_int() { check(0); return integer; }
+    int as_int() const { check(0); return integer; }
+    float& as_float() { check(1); return real; }
+    float as_float() const { check(1); return real; }
+    const string& as_string() const { check(2); return *text; }
+
+    bool operator==(const Value& other) const
+    {
+        if (tag != other.tag)
+            return false;
+        if (tag == 0)
+            return integer == other.integer;
+        if (tag == 1)
+            return real == other.real;
+        return *text == *other.text;
+    }
+};
+
+static_assert(sizeof(Value) <= 16 && is_trivially_copyable<Value>::value, "Value must stay small and trivially copyable");
 
 /* ###############################
    #        LEXER                #
    ###############################
 */
 
-string INTEGER = "INTEGER", PLUS = "PLUS", MINUS = "MINUS", MUL = "MUL", DIV = "DIV", EOL = "EOL", LPAREN = "(", RPAREN = ")", POW = "POW", BEGIN = "BEGIN", END = "END", DOT = "DOT",
-ID = "ID", ASSIGN = "ASSIGN", SEMI = "SEMI", PROGRAM = "PROGRAM", VAR = "VAR", COLON = "COLON", WHILE = "WHILE", ENDWHILE = "ENDWHILE",
-COMMA = "COMMA", REAL = "REAL", INTEGER_CONST = "INTEGER_CONST", REAL_CONST = "REAL_CONST", IF = "IF", ELSE = "ELSE", ENDIF = "ENDIF",
-INTEGER_DIV = "INTEGER_DIV", FLOAT_DIV = "FLOAT_DIV", PROCEDURE = "PROCEDURE", PRINT = "PRINT", READ = "READ", QUOTE = "QUOTE", SEP = "SEP";
+enum TokenType : unsigned char
+{
+    INTEGER, PLUS, MINUS, MUL, EOL, LPAREN, RPAREN, POW, BEGIN, END, DOT,
+    ID, ASSIGN, SEMI, PROGRAM, VAR, COLON, WHILE, ENDWHILE,
+    COMMA, REAL, INTEGER_CONST, REAL_CONST, IF, ELSE, ENDIF,
+    INTEGER_DIV, FLOAT_DIV, PROCEDURE, PRINT, READ, QUOTE, SEP,
+    TOKEN_TYPE_COUNT
+};
+
+constexpr const char* TOKEN_TYPE_NAMES[TOKEN_TYPE_COUNT] =
+{
+    "INTEGER", "PLUS", "MINUS", "MUL", "EOL", "(", ")", "POW", "BEGIN", "END", "DOT",
+    "ID", "ASSIGN", "SEMI", "PROGRAM", "VAR", "COLON", "WHILE", "ENDWHILE",
+    "COMMA", "REAL", "INTEGER_CONST", "REAL_CONST", "IF", "ELSE", "ENDIF",
+    "INTEGER_DIV", "FLOAT_DIV", "PROCEDURE", "PRINT", "READ", "QUOTE", "SEP"
+};
 
 class Token
 {
 public:
 
     string value; //will store the value in string
-    string type; //will store the word
+    TokenType type; //will store the kind of the word
+    size_t pos; //offset in the source, line and column are derived from it when needed
 
     Token()
     {
         this->value = "";
-        this->type = "";
+        this->type = EOL;
+        this->pos = 0;
     }
 
-    Token(string type, string value)
+    Token(TokenType type, string value, size_t pos = 0)
     {
         this->value = value;
         this->type = type;
+        this->pos = pos;
     }
 
 };
 
 //To print the token in the correct format
 ostream& operator<<(ostream& strm, const Token& token) {
-    return strm << "(" << token.type << ", " << token.value << ")";
+    return strm << "(" << TOKEN_TYPE_NAMES[token.type] << ", " << token.value << ")";
 }
 
-unordered_map<string, class Token> RESERVED_KEYWORDS;
+/*
+   Reserved keywords are found through a perfect hash of the word's length, first and
+   last character. The table is built at compile time and checked to be collision free.
+*/
+struct Keyword
+{
+    string_view text;
+    TokenType type;
+};
+
+constexpr Keyword RESERVED_KEYWORDS[] =
+{
+    { "PROGRAM", PROGRAM }, { "VAR", VAR }, { "DIV", INTEGER_DIV }, { "INTEGER", INTEGER }, { "REAL", REAL },
+    { "BEGIN", BEGIN }, { "END", END }, { "PROCEDURE", PROCEDURE }, { "PRINT", PRINT }, { "READ", READ },
+    { "IF", IF }, { "ELSE", ELSE }, { "ENDIF", ENDIF }, { "WHILE", WHILE }, { "ENDWHILE", ENDWHILE }
+};
+
+constexpr int KEYWORD_TABLE_SIZE = 27;
+
+constexpr int keyword_hash(string_view text)
+{
+    return (text.size() * 5 + text[0] * 4 + text[text.size() - 1]) % KEYWORD_TABLE_SIZE;
+}
 
+struct KeywordTable
+{
+    Keyword entries[KEYWORD_TABLE_SIZE];
+    bool perfect;
+};
 
+constexpr KeywordTable build_keyword_table()
+{
+    KeywordTable table = {};
+    table.perfect = true;
+    for (const Keyword& keyword : RESERVED_KEYWORDS)
+    {
+        Keyword& entry = table.entries[keyword_hash(keyword.text)];
+        if (!entry.text.empty())
+            table.perfect = false;
+        entry = keyword;
+    }
+    return table;
+}
+
+constexpr KeywordTable KEYWORD_TABLE = build_keyword_table();
+static_assert(KEYWORD_TABLE.perfect, "keyword hash has collisions, pick new constants for keyword_hash");
+
+//ID when the word is not a reserved keyword
+TokenType keyword_type(string_view text)
+{
+    if (text.size() < 2 || text.size() > 9)
+        return ID;
+    const Keyword& entry = KEYWORD_TABLE.entries[keyword_hash(text)];
+    return entry.text == text ? entry.type : ID;
+}
+
+
+//Reads up to size bytes, 0 at end of input and -1 on error
+long read_chunk(int fd, char* destination, size_t size)
+{
+    long count;
+    do
+    {
+#ifdef _WIN32
+        count = _read(fd, destination, (unsigned int)size);
+#else
+        count = read(fd, destination, size);
+#endif
+    } while (count < 0 && errno == EINTR);
+    return count;
+}
+
+//Window storage of a streaming lexer, shared by its copies, closes the descriptor if it owns it
+class StreamWindow
+{
+
+public:
+    int fd;
+    bool owns_fd;
+    vector<char> storage;
+
+    StreamWindow(int fd, bool owns_fd)
+    {
+        this->fd = fd;
+        this->owns_fd = owns_fd;
+    }
+
+    StreamWindow(const StreamWindow&) = delete;
+    StreamWindow& operator=(const StreamWindow&) = delete;
+
+    ~StreamWindow()
+    {
+        if (!owns_fd)
+            return;
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+};
+
+/*
+   The lexer reads from a window over the program text. For a mapped file the window
+   is the whole program. In streaming mode it is refilled in fixed-size chunks from
+   a file descriptor, keeping only the token being scanned, so memory stays bounded
+   however long the program is. Lines are then counted as the window moves on rather
+   than indexed, so location() only knows offsets still inside the window, which
+   includes the token most recently returned; --profile asks for the full index with
+   keep_line_index() since it reports lines of the whole program.
+*/
 class Lexer
 {
-    string text;
-    int pos;
-    
+    string_view text;   //the current window
+    size_t pos;         //position inside the window
+    size_t mark;        //window position where the token being scanned starts
+    size_t window_offset; //source offset of the window's first character
+
+    int fd;             //-1 unless streaming
+    bool at_eof;
+    size_t chunk_size;
+    shared_ptr<StreamWindow> buffer; //window storage when streaming, shared by copies of the lexer
+
+    bool indexing;      //keeps line_starts, always for a mapped program
+    vector<size_t> line_starts; //source offsets where lines start, indexed up to indexed_until
+    size_t indexed_until;
+    size_t window_lines;        //newlines before the window, when not indexing
+    size_t window_line_start;   //source offset of the line the window starts in
+
 public:
-    int lineno, column;
     char current_char;
+    size_t token_start; //offset of the token most recently returned
+    size_t tokens;      //tokens returned so far
 
     Lexer()
     {
-        this->pos = 0;
+        this->pos = this->mark = this->window_offset = 0;
+        this->fd = -1;
+        this->at_eof = true;
+        this->chunk_size = 0;
+        this->indexing = true;
+        this->indexed_until = 0;
+        this->window_lines = this->window_line_start = 0;
         this->current_char = '\0';
-        this->lineno = 1;
-        this->column = 1;
+        this->token_start = 0;
+        this->tokens = 0;
     }
 
-    Lexer(string text)
+    Lexer(string_view text) : Lexer()
     {
         this->text = text;
-        this->pos = 0;
-        this->current_char = text[pos];
-        this->lineno = 1;
-        this->column = 1;
-        add_keywords();
+        this->current_char = text.empty() ? '\0' : text[pos];
     }
 
-    void add_keywords()
-    {
-        RESERVED_KEYWORDS[PROGRAM] = Token("PROGRAM", PROGRAM);
-        RESERVED_KEYWORDS[VAR] = Token("VAR", VAR);
-        RESERVED_KEYWORDS[DIV] = Token("INTEGER_DIV", DIV);
-        RESERVED_KEYWORDS[INTEGER] = Token("INTEGER", INTEGER);
-        RESERVED_KEYWORDS[REAL] = Token("REAL", REAL);
-        RESERVED_KEYWORDS[BEGIN] = Token("BEGIN", BEGIN);
-        RESERVED_KEYWORDS[END] = Token("END", END);
-        RESERVED_KEYWORDS[PROCEDURE] = Token("PROCEDURE", PROCEDURE);
-        RESERVED_KEYWORDS[PRINT] = Token("PRINT", PRINT);
-        RESERVED_KEYWORDS[READ] = Token("READ", READ);
-        RESERVED_KEYWORDS[IF] = Token("IF", IF);
-        RESERVED_KEYWORDS[ELSE] = Token("ELSE", ELSE);
-        RESERVED_KEYWORDS[ENDIF] = Token("ENDIF", ENDIF);
-        RESERVED_KEYWORDS[WHILE] = Token("WHILE", WHILE);
-        RESERVED_KEYWORDS[ENDWHILE] = Token("ENDWHILE", ENDWHILE);
+    //Streaming mode, reads the program from fd chunk_size bytes at a time and closes it when
+    //the last copy of the lexer is gone if it owns it
+    Lexer(int fd, bool owns_fd = false, size_t chunk_size = 64 * 1024) : Lexer()
+    {
+        this->fd = fd;
+        this->at_eof = false;
+        this->chunk_size = chunk_size;
+        this->indexing = false;
+        this->buffer = make_shared<StreamWindow>(fd, owns_fd);
+        refill();
+        this->current_char = text.empty() ? '\0' : text[pos];
     }
 
-    void error()
+    //Indexes every line of a streamed program too, call it before the first token is scanned
+    void keep_line_index()
     {
-        cout << "ERROR:: Lexer error on '"<<current_char<< "' line:: "<<lineno<<":"<<column<<endl;
-        _Exit(10);
+        indexing = true;
     }
 
-    Token id()
+    //1 based line and column of a source offset
+    pair<int, int> location(size_t offset)
     {
-        string result;
-        while (current_char != '\0' && isalnum(current_char))
+        if (!indexing)
         {
-            result += current_char;
-            advance();
+            size_t line = window_lines;
+            size_t line_start = window_line_start;
+            const char* stop = text.data() + min(offset - min(offset, window_offset), text.size());
+            for (const char* p = text.data(); (p = (const char*)memchr(p, '\n', stop - p)) != NULL; p++)
+            {
+                line++;
+                line_start = window_offset + (p - text.data()) + 1;
+            }
+            return { (int)line + 1, (int)(offset - min(offset, line_start)) + 1 };
+        }
+
+        index_lines(window_offset + text.size());
+        if (line_starts.empty())
+            line_starts.push_back(0);
+
+        size_t line = upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+        return { (int)line, (int)(offset - line_starts[line - 1]) + 1 };
+    }
+
+    //Source offset of the character being scanned, the size of the source once it is all read
+    size_t offset()
+    {
+        return window_offset + pos;
+    }
+
+    [[noreturn]] void error()
+    {
+        pair<int, int> where = location(window_offset + pos);
+        fail("Lexer error on '" + string(1, current_char) + "' line:: " + to_string(where.first) + ":" + to_string(where.second));
+    }
+
+private:
+    //Records the line starts in the window up to source offset 'end'
+    void index_lines(size_t end)
+    {
+        if (line_starts.empty())
+            line_starts.push_back(0);
+        if (end <= indexed_until)
+            return;
+
+        const char* begin = text.data() + (indexed_until - window_offset);
+        const char* stop = text.data() + (end - window_offset);
+        for (const char* p = begin; (p = (const char*)memchr(p, '\n', stop - p)) != NULL; p++)
+            line_starts.push_back(window_offset + (p - text.data()) + 1);
+        indexed_until = end;
+    }
+
+    //Counts the lines in the window before window position 'end', which is about to be dropped
+    void count_lines(size_t end)
+    {
+        const char* stop = text.data() + end;
+        for (const char* p = text.data(); (p = (const char*)memchr(p, '\n', stop - p)) != NULL; p++)
+        {
+            window_lines++;
+            window_line_start = window_offset + (p - text.data()) + 1;
         }
-   
-        if (RESERVED_KEYWORDS.find(result) == RESERVED_KEYWORDS.end())
-            return RESERVED_KEYWORDS[result] = Token(ID, result);
+    }
+
+    //Drops everything before the token being scanned and reads the next chunk
+    bool refill()
+    {
+        if (at_eof)
+            return false;
+
+        vector<char>& storage = buffer->storage;
+        size_t keep_from = min(mark, pos);
+        if (indexing)
+            index_lines(window_offset + keep_from);
         else
-            return RESERVED_KEYWORDS[result];
+            count_lines(keep_from);
+        size_t kept = text.size() - keep_from;
+        if (keep_from > 0)
+            memmove(storage.data(), storage.data() + keep_from, kept);
+        window_offset += keep_from;
+        pos -= keep_from;
+        if (mark != string_view::npos)
+            mark -= keep_from;
+
+        storage.resize(kept + chunk_size);
+        long count = read_chunk(fd, storage.data() + kept, chunk_size);
+        if (count <= 0)
+        {
+            at_eof = true;
+            count = 0;
+        }
+        storage.resize(kept + count);
+        text = string_view(storage.data(), storage.size());
+        return count > 0;
+    }
+
+public:
+    Token id()
+    {
+        while (current_char != '\0' && isalnum(current_char))
+            advance();
+
+        string_view word = text.substr(mark, pos - mark);
+        return Token(keyword_type(word), string(word), window_offset + mark);
     }
 
     char peek()
     {
-        int peek_pos = pos + 1;
-        if (peek_pos > text.size() - 1)
+        size_t peek_pos = pos + 1;
+        if (peek_pos >= text.size() && !refill())
             return '\0';
         else
-            return text[peek_pos];
+            return text[pos + 1];
     }
 
     void advance()
     {
-        if (current_char == '\n')
-        {
-            this->lineno++;
-            this->column = 0;
-        }
-
         pos++;
-        if (pos > text.size() - 1)
+        if (pos >= text.size() && !refill())
             current_char = '\0';
         else
-        {
             current_char = text[pos];
-            this->column++;
-        }
     }
 
     void skip_whitspace()
@@ -179,44 +480,59 @@ public:
 
     void skip_comment()
     {
-        while (current_char != '}')
-            advance();
+        size_t end;
+        while ((end = text.find('}', pos)) == string_view::npos)
+        {
+            pos = text.size();
+            if (!refill())
+            {
+                current_char = '\0';
+                return;
+            }
+        }
+        pos = end;
         advance(); //for the closing bracket
     }
 
     Token number()
     {
-        Token token;
-        string result = "";
+        TokenType type = INTEGER_CONST;
         while (current_char != '\0' && current_char >= 48 && current_char <= 57)
-        {
-            result += current_char;
             advance();
-        }
 
         if (current_char == '.')
         {
-            result += current_char;
             advance();
-
             while (current_char != '\0' && current_char >= 48 && current_char <= 57)
-            {
-                result += current_char;
                 advance();
-            }
-
-            token = Token("REAL_CONST", result);
+            type = REAL_CONST;
         }
-        else
-            token = Token("INTEGER_CONST", result);
 
+        return Token(type, string(text.substr(mark, pos - mark)), window_offset + mark);
+    }
+
+    //Token made of the current character (or the next 'length' characters)
+    Token single(TokenType type, size_t length = 1)
+    {
+        Token token(type, string(text.substr(pos, length)), window_offset + pos);
+        for (size_t i = 0; i < length; i++)
+            advance();
         return token;
     }
 
     /* ******LEXICAL ANALYSER****** */
     Token get_next_token()
     {
+        Token token = scan();
+        token_start = token.pos;
+        tokens++;
+        return token;
+    }
 
+    Token scan()
+    {
+
+        mark = string_view::npos; //nothing to keep while skipping blanks and comments
         while (current_char == '\n' || current_char == ' ')
         {
             if (current_char == '\n')
@@ -227,131 +543,49 @@ public:
         }
         
         if (current_char == '\0')
-            return Token(EOL, "\0");
+            return Token(EOL, "\0", window_offset + pos);
 
         if (current_char == '{')
         {
             advance();
             skip_comment();
-            return get_next_token();
+            return scan();
         }
 
-        string current_char_str;
-        current_char_str = current_char;
-                
+        mark = pos;
 
         //Means we have a digit
         if (current_char >= 48 && current_char <= 57)
-        {
             return number();
-        }
-
-        if (current_char == '+')
-        {
-            Token token(PLUS, current_char_str);
-            advance();
-            return token;
-        }
-
-        if (current_char == '-')
-        {
-            Token token(MINUS, current_char_str);
-            advance();
-            return token;
-        }
-
-        if (current_char == '*')
-        {
-            Token token(MUL, current_char_str);
-            advance();
-            return token;
-        }
-
-        if (current_char == '(')
-        {
-            Token token(LPAREN, current_char_str);
-            advance();
-            return token;
-        }
-
-        if (current_char == ')')
-        {
-            Token token(RPAREN, current_char_str);
-            advance();
-            return token;
-        }
-
-        if (current_char == '^')
-        {
-            Token token(POW, current_char_str);
-            advance();
-            return token;
-        }
 
         if (isalpha(current_char))
-        {
             return id();
-        }
-
-        if (current_char == ':' && peek() == '=')
-        {
-            Token token(ASSIGN, ":=");
-            advance();
-            advance();
-            return token;
-        }
-
-        if (current_char == '<' && peek() == '<')
-        {
-            Token token(SEP, "<<");
-            advance();
-            advance();
-            return token;
-        }
 
-        if (current_char == ';')
+        switch (current_char)
         {
-            Token token(SEMI, ";");
-            advance();
-            return token;
-        }
-
-        if (current_char == '.')
-        {
-            Token token(DOT, ".");
-            advance();
-            return token;
-        }
-
-        if (current_char == ':')
-        {
-            Token token(COLON, ":");
-            advance();
-            return token;
-        }
-
-        if (current_char == ',')
-        {
-            Token token(COMMA, ",");
-            advance();
-            return token;
-        }
-
-        if (current_char == '/')
-        {
-            Token token(FLOAT_DIV, "/");
-            advance();
-            return token;
-        }
-
-        if (current_char == '"')
-        {
-            Token token(QUOTE, "\"");
-            advance();
-            return token;
+        case '+': return single(PLUS);
+        case '-': return single(MINUS);
+        case '*': return single(MUL);
+        case '(': return single(LPAREN);
+        case ')': return single(RPAREN);
+        case '^': return single(POW);
+        case ';': return single(SEMI);
+        case '.': return single(DOT);
+        case ',': return single(COMMA);
+        case '/': return single(FLOAT_DIV);
+        case '"': return single(QUOTE);
+        case ':':
+            if (peek() == '=')
+                return single(ASSIGN, 2);
+            return single(COLON);
+        case '<':
+            if (peek() == '<')
+                return single(SEP, 2);
+            break;
         }
 
         //If it isnt a digit or + or -, then some other char, hence show error
         error();
+        return Token();
     }
-};
\ No newline at end of file
+};
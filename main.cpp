@@ -1,25 +1,66 @@
-#include "interpreter.h"
+#include "batch.h"
 
-int main()
+int main(int argc, char* argv[])
 {
-    string text;
-    string line;
-    ifstream MyReadfile("sample.txt");
-    while (getline(MyReadfile, line))
-        text = text + line + "\n";
-    text = text.substr(0, text.size() - 1);
+    install_output_buffer();
+    RunOptions options;
+    vector<string> files;
+    bool batch = false;
+    int jobs = max(1u, thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0)
+            options.engine = arg.substr(9);
+        else if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--no-optimize")
+            options.optimize = false;
+        else if (arg == "--optimizer-report")
+            options.optimizer_report = true;
+        else if (arg.rfind("--jit-threshold=", 0) == 0)
+            options.jit_threshold = stoi(arg.substr(16));
+        else if (arg == "--profile")
+            options.profile = true;
+        else if (arg == "--stats")
+            options.stats = "text";
+        else if (arg == "--stats=json")
+            options.stats = "json";
+        else if (arg == "--cache")
+            options.cache_directory = ".decipher-cache";
+        else if (arg.rfind("--cache=", 0) == 0)
+            options.cache_directory = arg.substr(8);
+        else if (arg.rfind("--max-depth=", 0) == 0)
+            options.max_depth = stoi(arg.substr(12));
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg.rfind("--jobs=", 0) == 0)
+            jobs = max(1, stoi(arg.substr(7)));
+        else
+            files.push_back(arg);
+    }
 
-    string temp = text;
+    string problem = options.problem();
+    if (problem.empty() && !options.cache_directory.empty() && !files.empty() && files.back() == "-")
+        problem = "--cache needs a program file that is not streamed";
+    if (problem.empty() && batch && files.empty())
+        problem = "--batch needs program files, directories or @LIST files";
+    if (!problem.empty())
+    {
+        cout << "ERROR:: " << problem << endl;
+        return 10;
+    }
 
-
-    Lexer lexer(text);
-    Parser parser(lexer);
-    boostvar tree = parser.parse();
-    SemanticAnalyzer semantic_analyser;
-    semantic_analyser.visit(tree);
-    Interpreter interpreter(tree);
-    typevar result = interpreter.interpret();
-    cout << "Your code has been Interpreted successfully!" << endl;
-    //for (auto i : GLOBAL_SCOPE)
-        //cout << i.first << " : " << i.second << "\n";
+    try
+    {
+        if (batch)
+            return run_batch(files, options, jobs);
+        RunContext context(cout.rdbuf(), 0);
+        run_file(files.empty() ? "sample.txt" : files.back(), options, context, cerr);
+    }
+    catch (ProgramError& error)
+    {
+        cout << "ERROR:: " << error.what() << endl;
+        return 10;
+    }
 }
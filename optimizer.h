@@ -0,0 +1,812 @@
+#pragma once
+#include "interpreter.h"
+#include <climits>
+#include <sstream>
+#include <unordered_set>
+#include <set>
+
+/* ###############################
+   #        OPTIMIZER            #
+   ###############################
+*/
+
+//Number of AST nodes in a subtree, by_kind (indexed by which()) also gets the count of every kind
+int count_nodes(boostvar node, vector<int>* by_kind = NULL)
+{
+    int count = 1;
+    if (by_kind)
+        (*by_kind)[node.which()]++;
+    switch (node.which())
+    {
+    case 0:
+        count += count_nodes(boost::get<BinOp*>(node)->left, by_kind) + count_nodes(boost::get<BinOp*>(node)->right, by_kind);
+        break;
+    case 2:
+        count += count_nodes(boost::get<UnaryOp*>(node)->expr, by_kind);
+        break;
+    case 3:
+        for (auto child : boost::get<Compound*>(node)->children)
+            count += count_nodes(child, by_kind);
+        break;
+    case 4:
+        count += count_nodes(boost::get<Assign*>(node)->left, by_kind) + count_nodes(boost::get<Assign*>(node)->right, by_kind);
+        break;
+    case 7:
+        count += count_nodes(boost::get<Program*>(node)->block, by_kind);
+        break;
+    case 8:
+        for (auto declaration : boost::get<Block*>(node)->declarations)
+            count += count_nodes(declaration, by_kind);
+        count += count_nodes(boost::get<Block*>(node)->compound_statement, by_kind);
+        break;
+    case 9:
+        count += 2; //variable and type
+        if (by_kind)
+        {
+            (*by_kind)[5]++;
+            (*by_kind)[10]++;
+        }
+        break;
+    case 13:
+        count += 3 * boost::get<ProcedureDecl*>(node)->params.size() + count_nodes(boost::get<ProcedureDecl*>(node)->block_node, by_kind);
+        if (by_kind)
+        {
+            int params = boost::get<ProcedureDecl*>(node)->params.size();
+            (*by_kind)[14] += params; //each with a variable and a type
+            (*by_kind)[5] += params;
+            (*by_kind)[10] += params;
+        }
+        break;
+    case 16:
+        for (auto message : boost::get<Print*>(node)->messages)
+            count += count_nodes(message, by_kind);
+        break;
+    case 17:
+        for (auto param : boost::get<ProcedureCall*>(node)->actual_params)
+            count += count_nodes(param, by_kind);
+        break;
+    case 18:
+        count += 1;
+        if (by_kind)
+            (*by_kind)[5]++;
+        break;
+    case 19:
+        count += count_nodes(boost::get<Condition*>(node)->condition_node, by_kind);
+        for (auto statement : boost::get<Condition*>(node)->if_statements)
+            count += count_nodes(statement, by_kind);
+        for (auto statement : boost::get<Condition*>(node)->else_statements)
+            count += count_nodes(statement, by_kind);
+        break;
+    case 20:
+        count += count_nodes(boost::get<Loop*>(node)->condition_node, by_kind);
+        for (auto statement : boost::get<Loop*>(node)->statements)
+            count += count_nodes(statement, by_kind);
+        break;
+    case 22:
+        count += count_nodes(boost::get<Invariant*>(node)->expr, by_kind);
+        break;
+    }
+    return count;
+}
+
+/* ###############################
+   #     CONSTANT FOLDING        #
+   ###############################
+*/
+
+/*
+   Replaces constant BinOp/UnaryOp subtrees by a single Num, computed with the same
+   kernels the engines use, and drops operations that cannot change their operand
+   (x+0, x-0, x*1, x DIV 1, x/1 and unary plus). An identity is only applied when the
+   operand's static type is known, since e.g. x*1 throws at run time for a REAL x. Constants
+   whose evaluation fails at run time (type mismatch, division by zero, overflow) are
+   left in place so the error still happens when, and only if, that code runs.
+*/
+class ConstantFolder
+{
+    Arena* arena;
+
+public:
+    int nodes_removed;
+
+    ConstantFolder(Arena* arena)
+    {
+        this->arena = arena;
+        this->nodes_removed = 0;
+    }
+
+    void visit(boostvar node)
+    {
+        if (node.which() == 3)
+        {
+            for (auto child : boost::get<Compound*>(node)->children)
+                visit(child);
+        }
+        else if (node.which() == 4)
+        {
+            Assign* assign = boost::get<Assign*>(node);
+            assign->right = fold_expression(assign->right);
+        }
+        else if (node.which() == 7)
+            visit(boost::get<Program*>(node)->block);
+        else if (node.which() == 8)
+        {
+            Block* block = boost::get<Block*>(node);
+            for (auto declaration : block->declarations)
+            {
+                if (declaration.which() == 13)
+                    visit(boost::get<ProcedureDecl*>(declaration)->block_node);
+            }
+            visit(block->compound_statement);
+        }
+        else if (node.which() == 16)
+        {
+            for (auto& message : boost::get<Print*>(node)->messages)
+                message = fold_expression(message);
+        }
+        else if (node.which() == 17)
+        {
+            for (auto& param : boost::get<ProcedureCall*>(node)->actual_params)
+                param = fold_expression(param);
+        }
+        else if (node.which() == 19)
+        {
+            Condition* condition = boost::get<Condition*>(node);
+            condition->condition_node = fold_expression(condition->condition_node);
+            for (auto statement : condition->if_statements)
+                visit(statement);
+            for (auto statement : condition->else_statements)
+                visit(statement);
+        }
+        else if (node.which() == 20)
+        {
+            Loop* loop = boost::get<Loop*>(node);
+            loop->condition_node = fold_expression(loop->condition_node);
+            for (auto statement : loop->statements)
+                visit(statement);
+        }
+    }
+
+    boostvar fold_expression(boostvar node)
+    {
+        int before = count_nodes(node);
+        boostvar folded = fold(node);
+        nodes_removed += before - count_nodes(folded);
+        return folded;
+    }
+
+    //Value of an expression made only of literals, false when it is not constant or fails at run time
+    static bool constant_value(boostvar node, Value& value)
+    {
+        if (node.which() == 1)
+        {
+            value = boost::get<Num*>(node)->constant;
+            return true;
+        }
+        else if (node.which() == 2)
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            if (!constant_value(unary_op->expr, value))
+                return false;
+            if (unary_op->op.type == MINUS)
+            {
+                if (value.which() == 0 && value.as_int() == INT_MIN)
+                    return false;
+                value = negate_value(value);
+            }
+            return true;
+        }
+        else if (node.which() == 0)
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            Value left, right;
+            return constant_value(bin_op->left, left) && constant_value(bin_op->right, right) &&
+                evaluate(bin_op->op.type, left, right, value);
+        }
+        return false;
+    }
+
+    //Evaluates a constant operation the way the engines would, false when it would fail at run time
+    static bool evaluate(TokenType op, const Value& left, const Value& right, Value& result)
+    {
+        if (left.which() != right.which())
+            return false;
+
+        if (left.which() == 0)
+        {
+            int a = left.as_int(), b = right.as_int(), value;
+            switch (op)
+            {
+            case PLUS:
+                if (__builtin_add_overflow(a, b, &value)) return false;
+                break;
+            case MINUS:
+                if (__builtin_sub_overflow(a, b, &value)) return false;
+                break;
+            case MUL:
+                if (__builtin_mul_overflow(a, b, &value)) return false;
+                break;
+            case INTEGER_DIV:
+            case FLOAT_DIV:
+                if (b == 0 || (a == INT_MIN && b == -1)) return false;
+                value = a / b;
+                break;
+            default:
+            {
+                double power = pow(a, b) + 0.5;
+                if (!(power > INT_MIN - 1.0 && power < INT_MAX + 1.0)) return false;
+                value = int(power);
+            }
+            }
+            result = value;
+            return true;
+        }
+
+        float a = left.as_float(), b = right.as_float();
+        if (op == INTEGER_DIV)
+        {
+            float quotient = a / b;
+            if (!(quotient > INT_MIN - 1.0f && quotient < INT_MAX + 1.0f)) return false;
+        }
+        else if (op == POW)
+            return false; //a REAL exponent throws at run time
+        result = op == PLUS ? add_values(left, right) :
+            op == MINUS ? subtract_values(left, right) :
+            op == MUL ? multiply_values(left, right) :
+            op == INTEGER_DIV ? integer_divide_values(left, right) : float_divide_values(left, right);
+        return true;
+    }
+
+private:
+    boostvar fold(boostvar node)
+    {
+        if (node.which() == 0)
+            return fold_BinOp(boost::get<BinOp*>(node));
+        else if (node.which() == 2)
+            return fold_UnaryOp(boost::get<UnaryOp*>(node));
+        return node;
+    }
+
+    boostvar make_constant(Value value, size_t pos)
+    {
+        ostringstream text;
+        if (value.which() == 0)
+            text << value.as_int();
+        else
+            text << value.as_float();
+        Token token(value.which() == 0 ? INTEGER_CONST : REAL_CONST, text.str(), pos);
+        return arena->make<Num>(token, value);
+    }
+
+    static bool is_constant(boostvar node, Value value)
+    {
+        return node.which() == 1 && boost::get<Num*>(node)->constant == value;
+    }
+
+    boostvar fold_BinOp(BinOp* node)
+    {
+        node->left = fold(node->left);
+        node->right = fold(node->right);
+
+        if (node->left.which() == 1 && node->right.which() == 1)
+        {
+            Value result;
+            if (evaluate(node->op.type, boost::get<Num*>(node->left)->constant, boost::get<Num*>(node->right)->constant, result))
+                return make_constant(result, node->op.pos);
+            return node;
+        }
+
+        //Identities only hold when both operands are known to be of the same type
+        StaticType type = static_type(node->left);
+        if ((type != INT_TYPE && type != FLOAT_TYPE) || type != static_type(node->right))
+            return node;
+        Value zero = 0, one = 1;
+        if (type == FLOAT_TYPE)
+        {
+            zero = 0.0f;
+            one = 1.0f;
+        }
+
+        switch (node->op.type)
+        {
+        case PLUS: //x+0 is not exact for a REAL -0.0
+            if (type == INT_TYPE && is_constant(node->right, zero)) return node->left;
+            if (type == INT_TYPE && is_constant(node->left, zero)) return node->right;
+            break;
+        case MINUS: //x-(-0.0) is x+0.0, which is not exact either
+            if (is_constant(node->right, zero) &&
+                (type == INT_TYPE || !signbit(boost::get<Num*>(node->right)->constant.as_float())))
+                return node->left;
+            break;
+        case MUL:
+            if (is_constant(node->right, one)) return node->left;
+            if (is_constant(node->left, one)) return node->right;
+            break;
+        case INTEGER_DIV:
+            if (type == INT_TYPE && is_constant(node->right, one)) return node->left;
+            break;
+        case FLOAT_DIV:
+            if (is_constant(node->right, one)) return node->left;
+            break;
+        default:
+            break;
+        }
+        return node;
+    }
+
+    boostvar fold_UnaryOp(UnaryOp* node)
+    {
+        node->expr = fold(node->expr);
+        if (node->op.type != MINUS)
+            return node->expr;
+
+        if (node->expr.which() == 1)
+        {
+            Value constant = boost::get<Num*>(node->expr)->constant;
+            if (constant.which() == 0 && constant.as_int() == INT_MIN)
+                return node;
+            return make_constant(negate_value(constant), node->op.pos);
+        }
+
+        //-(-x) gives x back for any number
+        if (node->expr.which() == 2 && static_type(node->expr) != UNKNOWN_TYPE)
+        {
+            UnaryOp* inner = boost::get<UnaryOp*>(node->expr);
+            if (inner->op.type == MINUS)
+                return inner->expr;
+        }
+        return node;
+    }
+};
+
+/* ###############################
+   #   DEAD CODE ELIMINATION     #
+   ###############################
+*/
+
+/*
+   Runs before the SemanticAnalyzer so dropped code is never analyzed. IF statements
+   with a constant condition are replaced by the branch that is taken, WHILE loops
+   whose condition is constantly false are removed, and procedures that cannot be
+   reached through the call graph from the main program are dropped from their block.
+*/
+class DeadCodeEliminator
+{
+    //Procedures visible at each nesting level, innermost last, like the SemanticAnalyzer's scopes
+    vector<unordered_map<string, ProcedureDecl*>> scopes;
+    unordered_map<ProcedureDecl*, vector<ProcedureDecl*>> callees;
+    unordered_set<ProcedureDecl*> reachable;
+
+public:
+    int branches_removed;
+    int procedures_removed;
+
+    DeadCodeEliminator()
+    {
+        this->branches_removed = 0;
+        this->procedures_removed = 0;
+    }
+
+    void eliminate(boostvar tree)
+    {
+        Block* block = boost::get<Block*>(boost::get<Program*>(tree)->block);
+        prune_block(block);
+
+        vector<ProcedureDecl*> roots;
+        collect_calls(block, roots);
+        vector<ProcedureDecl*> worklist = roots;
+        while (!worklist.empty())
+        {
+            ProcedureDecl* procedure = worklist.back();
+            worklist.pop_back();
+            if (!reachable.insert(procedure).second)
+                continue;
+            for (ProcedureDecl* callee : callees[procedure])
+                worklist.push_back(callee);
+        }
+        drop_unreachable(block);
+    }
+
+private:
+    void prune_block(Block* block)
+    {
+        for (auto declaration : block->declarations)
+        {
+            if (declaration.which() == 13)
+                prune_block(boost::get<Block*>(boost::get<ProcedureDecl*>(declaration)->block_node));
+        }
+        prune_statements(boost::get<Compound*>(block->compound_statement)->children);
+    }
+
+    void prune_statements(vector<boostvar>& statements)
+    {
+        vector<boostvar> kept;
+        for (auto statement : statements)
+        {
+            Value value;
+            if (statement.which() == 19 && ConstantFolder::constant_value(boost::get<Condition*>(statement)->condition_node, value))
+            {
+                Condition* condition = boost::get<Condition*>(statement);
+                vector<boostvar>& taken = is_truthy(value) ? condition->if_statements : condition->else_statements;
+                prune_statements(taken);
+                int taken_nodes = 0;
+                for (auto branch_statement : taken)
+                {
+                    taken_nodes += count_nodes(branch_statement);
+                    kept.push_back(branch_statement);
+                }
+                branches_removed += count_nodes(statement) - taken_nodes;
+                continue;
+            }
+            if (statement.which() == 20 && ConstantFolder::constant_value(boost::get<Loop*>(statement)->condition_node, value) && !is_truthy(value))
+            {
+                branches_removed += count_nodes(statement);
+                continue;
+            }
+
+            if (statement.which() == 3)
+                prune_statements(boost::get<Compound*>(statement)->children);
+            else if (statement.which() == 19)
+            {
+                prune_statements(boost::get<Condition*>(statement)->if_statements);
+                prune_statements(boost::get<Condition*>(statement)->else_statements);
+            }
+            else if (statement.which() == 20)
+                prune_statements(boost::get<Loop*>(statement)->statements);
+            kept.push_back(statement);
+        }
+        statements = kept;
+    }
+
+    //Records the procedures called from block's statements, and the call graph of its procedures
+    void collect_calls(Block* block, vector<ProcedureDecl*>& calls)
+    {
+        scopes.push_back({});
+        for (auto declaration : block->declarations)
+        {
+            if (declaration.which() == 13)
+            {
+                ProcedureDecl* procedure = boost::get<ProcedureDecl*>(declaration);
+                scopes.back()[procedure->proc_name] = procedure;
+            }
+        }
+        for (auto declaration : block->declarations)
+        {
+            if (declaration.which() == 13)
+            {
+                ProcedureDecl* procedure = boost::get<ProcedureDecl*>(declaration);
+                collect_calls(boost::get<Block*>(procedure->block_node), callees[procedure]);
+            }
+        }
+        collect_statement_calls(block->compound_statement, calls);
+        scopes.pop_back();
+    }
+
+    void collect_statement_calls(boostvar statement, vector<ProcedureDecl*>& calls)
+    {
+        if (statement.which() == 3)
+        {
+            for (auto child : boost::get<Compound*>(statement)->children)
+                collect_statement_calls(child, calls);
+        }
+        else if (statement.which() == 17)
+        {
+            ProcedureDecl* procedure = resolve(boost::get<ProcedureCall*>(statement)->proc_name);
+            if (procedure != NULL)
+                calls.push_back(procedure);
+        }
+        else if (statement.which() == 19)
+        {
+            for (auto child : boost::get<Condition*>(statement)->if_statements)
+                collect_statement_calls(child, calls);
+            for (auto child : boost::get<Condition*>(statement)->else_statements)
+                collect_statement_calls(child, calls);
+        }
+        else if (statement.which() == 20)
+        {
+            for (auto child : boost::get<Loop*>(statement)->statements)
+                collect_statement_calls(child, calls);
+        }
+    }
+
+    //Unknown names are left for the SemanticAnalyzer to report
+    ProcedureDecl* resolve(string name)
+    {
+        for (int i = scopes.size() - 1; i >= 0; i--)
+        {
+            auto found = scopes[i].find(name);
+            if (found != scopes[i].end())
+                return found->second;
+        }
+        return NULL;
+    }
+
+    void drop_unreachable(Block* block)
+    {
+        vector<boostvar> kept;
+        for (auto declaration : block->declarations)
+        {
+            if (declaration.which() == 13)
+            {
+                ProcedureDecl* procedure = boost::get<ProcedureDecl*>(declaration);
+                if (reachable.count(procedure) == 0)
+                {
+                    procedures_removed += count_nodes(declaration);
+                    continue;
+                }
+                drop_unreachable(boost::get<Block*>(procedure->block_node));
+            }
+            kept.push_back(declaration);
+        }
+        block->declarations = kept;
+    }
+};
+
+/* ###############################
+   #  LOOP-INVARIANT CODE MOTION #
+   ###############################
+*/
+
+/*
+   Finds the subexpressions of a WHILE loop that only read variables the loop never
+   writes, directly or through the procedures it calls, and wraps each of them in an
+   Invariant node backed by a new slot in the enclosing frame. The slot is cleared when
+   the loop is entered, so the expression is computed the first time it is reached and
+   reused afterwards. Because that first evaluation happens where the expression was,
+   a loop that never reaches it, or an expression that fails, behaves as before.
+*/
+class LoopInvariantMotion
+{
+    Arena* arena;
+    int* frame_size; //of the procedure being optimized, temporaries get slots past its variables
+    set<pair<int, int>> written; //(depth, slot) of every variable the current loop may assign
+
+public:
+    int nodes_hoisted;
+
+    LoopInvariantMotion(Arena* arena)
+    {
+        this->arena = arena;
+        this->frame_size = NULL;
+        this->nodes_hoisted = 0;
+    }
+
+    void visit(boostvar node)
+    {
+        if (node.which() == 3)
+        {
+            for (auto child : boost::get<Compound*>(node)->children)
+                visit(child);
+        }
+        else if (node.which() == 7)
+        {
+            Program* program = boost::get<Program*>(node);
+            frame_size = &program->frame_size;
+            visit(program->block);
+        }
+        else if (node.which() == 8)
+        {
+            Block* block = boost::get<Block*>(node);
+            for (auto declaration : block->declarations)
+            {
+                if (declaration.which() == 13)
+                {
+                    ProcedureDecl* procedure = boost::get<ProcedureDecl*>(declaration);
+                    int* enclosing_frame = frame_size;
+                    frame_size = &procedure->proc_symbol->frame_size;
+                    visit(procedure->block_node);
+                    frame_size = enclosing_frame;
+                }
+            }
+            visit(block->compound_statement);
+        }
+        else if (node.which() == 19)
+        {
+            for (auto statement : boost::get<Condition*>(node)->if_statements)
+                visit(statement);
+            for (auto statement : boost::get<Condition*>(node)->else_statements)
+                visit(statement);
+        }
+        else if (node.which() == 20)
+        {
+            Loop* loop = boost::get<Loop*>(node);
+            hoist_loop(loop);
+            for (auto statement : loop->statements)
+                visit(statement);
+        }
+    }
+
+private:
+    void hoist_loop(Loop* loop)
+    {
+        written.clear();
+        unordered_set<ProcedureSymbol*> visited;
+        for (auto statement : loop->statements)
+            collect_writes(statement, visited);
+
+        loop->condition_node = hoist(loop->condition_node, loop);
+        for (auto statement : loop->statements)
+            hoist_statement(statement, loop);
+    }
+
+    void collect_writes(boostvar node, unordered_set<ProcedureSymbol*>& visited)
+    {
+        switch (node.which())
+        {
+        case 3:
+            for (auto child : boost::get<Compound*>(node)->children)
+                collect_writes(child, visited);
+            break;
+        case 4:
+        {
+            Var* target = boost::get<Var*>(boost::get<Assign*>(node)->left);
+            written.insert({ target->depth, target->slot });
+            break;
+        }
+        case 17:
+        {
+            //The callee, and everything it calls, may assign the variables it can see
+            ProcedureSymbol* proc_symbol = boost::get<ProcedureCall*>(node)->proc_symbol;
+            if (visited.insert(proc_symbol).second)
+                collect_writes(boost::get<Block*>(proc_symbol->block_node)->compound_statement, visited);
+            break;
+        }
+        case 18:
+        {
+            Var* target = boost::get<Var*>(boost::get<Read*>(node)->var);
+            written.insert({ target->depth, target->slot });
+            break;
+        }
+        case 19:
+            for (auto child : boost::get<Condition*>(node)->if_statements)
+                collect_writes(child, visited);
+            for (auto child : boost::get<Condition*>(node)->else_statements)
+                collect_writes(child, visited);
+            break;
+        case 20:
+            for (auto child : boost::get<Loop*>(node)->statements)
+                collect_writes(child, visited);
+            break;
+        }
+    }
+
+    void hoist_statement(boostvar node, Loop* loop)
+    {
+        switch (node.which())
+        {
+        case 3:
+            for (auto child : boost::get<Compound*>(node)->children)
+                hoist_statement(child, loop);
+            break;
+        case 4:
+            boost::get<Assign*>(node)->right = hoist(boost::get<Assign*>(node)->right, loop);
+            break;
+        case 16:
+            for (auto& message : boost::get<Print*>(node)->messages)
+                message = hoist(message, loop);
+            break;
+        case 17:
+            for (auto& param : boost::get<ProcedureCall*>(node)->actual_params)
+                param = hoist(param, loop);
+            break;
+        case 19:
+        {
+            Condition* condition = boost::get<Condition*>(node);
+            condition->condition_node = hoist(condition->condition_node, loop);
+            for (auto child : condition->if_statements)
+                hoist_statement(child, loop);
+            for (auto child : condition->else_statements)
+                hoist_statement(child, loop);
+            break;
+        }
+        case 20:
+        {
+            Loop* inner = boost::get<Loop*>(node);
+            inner->condition_node = hoist(inner->condition_node, loop);
+            for (auto child : inner->statements)
+                hoist_statement(child, loop);
+            break;
+        }
+        }
+    }
+
+    //Wraps the largest invariant subexpressions of node, leaving single variables and constants alone
+    boostvar hoist(boostvar node, Loop* loop)
+    {
+        if (node.which() != 0 && node.which() != 2)
+            return node;
+
+        bool reads_variables = false;
+        if (is_invariant(node, reads_variables))
+        {
+            if (!reads_variables || count_nodes(node) < 3)
+                return node;
+            Invariant* invariant = arena->make<Invariant>(node, (*frame_size)++, static_type(node));
+            loop->invariant_slots.push_back(invariant->slot);
+            nodes_hoisted += count_nodes(node);
+            return invariant;
+        }
+
+        if (node.which() == 0)
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            bin_op->left = hoist(bin_op->left, loop);
+            bin_op->right = hoist(bin_op->right, loop);
+        }
+        else
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            unary_op->expr = hoist(unary_op->expr, loop);
+        }
+        return node;
+    }
+
+    bool is_invariant(boostvar node, bool& reads_variables)
+    {
+        switch (node.which())
+        {
+        case 0:
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            return is_invariant(bin_op->left, reads_variables) & is_invariant(bin_op->right, reads_variables);
+        }
+        case 2:
+            return is_invariant(boost::get<UnaryOp*>(node)->expr, reads_variables);
+        case 5:
+        {
+            Var* var = boost::get<Var*>(node);
+            reads_variables = true;
+            return written.count({ var->depth, var->slot }) == 0;
+        }
+        case 22:
+            reads_variables = true;
+            return true;
+        default:
+            return true;
+        }
+    }
+};
+
+/*
+   Runs the optimization passes over a program, in place. Every pass
+   reports how many nodes it took out of the tree, or out of loops.
+*/
+class Optimizer
+{
+    Arena* arena;
+
+public:
+    vector<pair<string, int>> report;
+
+    Optimizer(Arena* arena)
+    {
+        this->arena = arena;
+    }
+
+    //Passes that run on the parsed tree, before the SemanticAnalyzer
+    void eliminate_dead_code(boostvar tree)
+    {
+        DeadCodeEliminator eliminator;
+        eliminator.eliminate(tree);
+        report.push_back({ "constant branch elimination removed", eliminator.branches_removed });
+        report.push_back({ "unreachable procedure elimination removed", eliminator.procedures_removed });
+    }
+
+    //Passes that need the analyzed tree
+    void optimize(boostvar tree)
+    {
+        ConstantFolder folder(arena);
+        folder.visit(tree);
+        report.push_back({ "constant folding removed", folder.nodes_removed });
+
+        LoopInvariantMotion motion(arena);
+        motion.visit(tree);
+        report.push_back({ "loop-invariant code motion hoisted", motion.nodes_hoisted });
+    }
+
+    void print_report(ostream& out)
+    {
+        for (auto pass : report)
+            out << "Optimizer:: " << pass.first << " " << pass.second << " nodes" << endl;
+    }
+};
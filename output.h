@@ -0,0 +1,103 @@
+#pragma once
+#include "lexer.h"
+#include <charconv>
+#include <exception>
+
+/* ###############################
+   #        OUTPUT               #
+   ###############################
+*/
+
+/*
+   Everything PRINT writes goes through the Printer of its run, straight into the stream
+   buffer the run was given: cout's for the command line tool, one in memory per program
+   for the batch runner. cout gets a large buffer of its own instead of being synced with
+   stdio, and PRINT ends its line with '\n' rather than endl, so output leaves the process
+   in big blocks. The buffer is written out when it fills, before READ waits for more
+   input, when an error is reported, when the program finishes, and if it dies on an
+   exception. Numbers are formatted with to_chars exactly as cout would format them.
+*/
+const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+terminate_handler default_terminate = NULL;
+
+void flush_then_terminate()
+{
+    cout.flush();
+    default_terminate();
+}
+
+//Must run before anything is written to cout
+void install_output_buffer()
+{
+    static char buffer[OUTPUT_BUFFER_SIZE];
+    ios::sync_with_stdio(false);
+    cout.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+    default_terminate = set_terminate(flush_then_terminate);
+}
+
+class Printer
+{
+    streambuf* out;
+
+public:
+    size_t printed_bytes;   //everything PRINT has written
+
+    Printer(streambuf* out)
+    {
+        this->out = out;
+        this->printed_bytes = 0;
+    }
+
+    void print_int(int value)
+    {
+        char text[16];
+        char* end = to_chars(text, text + sizeof(text) - 1, value).ptr;
+        *end++ = ' ';
+        out->sputn(text, end - text);
+        printed_bytes += end - text;
+    }
+
+    void print_float(float value)
+    {
+        //general with precision 6 is what operator<< uses by default
+        char text[32];
+        char* end = to_chars(text, text + sizeof(text) - 1, value, chars_format::general, 6).ptr;
+        *end++ = ' ';
+        out->sputn(text, end - text);
+        printed_bytes += end - text;
+    }
+
+    void print_value(const Value& value)
+    {
+        if (value.which() == 0)
+            print_int(value.as_int());
+        else if (value.which() == 1)
+            print_float(value.as_float());
+        else
+        {
+            const string& text = value.as_string();
+            out->sputn(text.data(), text.size());
+            printed_bytes += text.size();
+        }
+    }
+
+    //Ends the line of one PRINT statement without flushing it
+    void print_end()
+    {
+        out->sputc('\n');
+        printed_bytes++;
+    }
+
+    //A line that is not PRINT output, like the success message or an error
+    void write_line(const string& text)
+    {
+        out->sputn(text.data(), text.size());
+        out->sputc('\n');
+    }
+
+    void flush()
+    {
+        out->pubsync();
+    }
+};
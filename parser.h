@@ -1,11 +1,22 @@
 #pragma once
 #include "lexer.h"
+#include "arena.h"
 
 /* ###############################
    #        PARSER               #
    ###############################
 */
 
+//What the SemanticAnalyzer proved about the values an expression can produce
+enum StaticType : unsigned char
+{
+    UNKNOWN_TYPE,   //may be INTEGER or REAL at run time
+    INT_TYPE,
+    FLOAT_TYPE,
+    STRING_TYPE,
+    NO_TYPE         //nothing is ever stored, only used while inferring
+};
+
 class AST
 {};
 
@@ -15,11 +26,13 @@ class Program : public AST
 public:
     string name;
     boostvar block;
+    int frame_size; //number of global slots, set by the SemanticAnalyzer
 
     Program(string name, boostvar block)
     {
         this->name = name;
         this->block = block;
+        this->frame_size = 0;
     }
 };
 
@@ -60,11 +73,13 @@ public:
     string proc_name;
     boostvar block_node;
     vector<boostvar> params;
+    ProcedureSymbol* proc_symbol;
 
     ProcedureDecl(string proc_name, boostvar block_node, vector<boostvar> params) {
         this->proc_name = proc_name;
         this->block_node = block_node;
         this->params = params;
+        this->proc_symbol = NULL;
     }
 };
 
@@ -76,6 +91,8 @@ public:
     vector<boostvar> actual_params;
     Token token;
     ProcedureSymbol* proc_symbol;
+    vector<char> integer_checks; //per argument, the parameter is INTEGER and the value may be REAL
+    bool tail_call;              //the last thing its procedure does, the callee takes over the caller's frame
 
     ProcedureCall(string proc_name, vector<boostvar> actual_params, Token token)
     {
@@ -83,6 +100,7 @@ public:
         this->actual_params = actual_params;
         this->token = token;
         this->proc_symbol = NULL;
+        this->tail_call = false;
     }
 };
 
@@ -108,11 +126,14 @@ class Read : public AST
 
 public:
     boostvar var;
-    boostvar value; //will be a Num node
+    bool integer_target; //the variable is declared INTEGER, so REAL input is rejected
+    size_t pos;          //source offset of the READ keyword
 
-    Read(boostvar var)
+    Read(boostvar var, size_t pos = 0)
     {
         this->var = var;
+        this->integer_target = false;
+        this->pos = pos;
     }
 };
 
@@ -121,10 +142,12 @@ class Print : public AST
 
 public:
     vector<boostvar> messages;
+    size_t pos; //source offset of the PRINT keyword
 
-    Print(vector<boostvar> messages = {})
+    Print(vector<boostvar> messages = {}, size_t pos = 0)
     {
         this->messages = messages;
+        this->pos = pos;
     }
 };
 
@@ -170,15 +193,18 @@ class Assign : public AST
 
 public:
     boostvar left;
-    Token token, op;
+    Token op;
     boostvar right;
+    int slot;               //frame slot of the target variable
+    bool integer_target;    //the target is declared INTEGER and the value may be REAL
 
     Assign(boostvar left, Token op, boostvar right)
     {
         this->left = left;
-        this->token = op;
         this->op = op;
         this->right = right;
+        this->slot = -1;
+        this->integer_target = false;
     }
 };
 
@@ -189,12 +215,14 @@ public:
     boostvar condition_node;
     vector<boostvar> if_statements;
     vector<boostvar> else_statements;
+    size_t pos; //source offset of the IF keyword
 
-    Condition(boostvar condition_node, vector<boostvar> if_statements, vector<boostvar> else_statements = {})
+    Condition(boostvar condition_node, vector<boostvar> if_statements, vector<boostvar> else_statements = {}, size_t pos = 0)
     {
         this->condition_node = condition_node;
         this->if_statements = if_statements;
         this->else_statements = else_statements;
+        this->pos = pos;
     }
 };
 
@@ -204,11 +232,14 @@ class Loop : public AST
 public:
     boostvar condition_node;
     vector<boostvar> statements;
+    vector<int> invariant_slots; //cached Invariant values, cleared every time the loop is entered
+    size_t pos;                  //source offset of the WHILE keyword
 
-    Loop(boostvar condition_node, vector<boostvar> statements)
+    Loop(boostvar condition_node, vector<boostvar> statements, size_t pos = 0)
     {
         this->condition_node = condition_node;
         this->statements = statements;
+        this->pos = pos;
     }
 };
 
@@ -218,11 +249,19 @@ class Var : public AST
 public:
     Token token;
     string value;
+    int slot;   //index into the activation record, set by the SemanticAnalyzer
+    int depth;  //scope level the variable was declared in
+    VarSymbol* symbol;
+    StaticType type;
 
     Var(Token token)
     {
         this->token = token;
         this->value = token.value;
+        this->slot = -1;
+        this->depth = 0;
+        this->symbol = NULL;
+        this->type = UNKNOWN_TYPE;
     }
 };
 
@@ -233,15 +272,16 @@ class BinOp : public AST
 {
 
 public:
-    Token token, op;
+    Token op;
     boostvar left, right;
+    StaticType type;
 
     BinOp(boostvar left, Token op, boostvar right)
     {
         this->left = left;
-        this->token = op;
         this->op = op;
         this->right = right;
+        this->type = UNKNOWN_TYPE;
     }
 };
 
@@ -250,12 +290,14 @@ class Num : public AST
 
 public:
     Token token;
-    string value;
+    Value constant; //the literal decoded once by the parser
+    StaticType type;
 
-    Num(Token token)
+    Num(Token token, Value constant)
     {
         this->token = token;
-        this->value = token.value;
+        this->constant = constant;
+        this->type = constant.which() == 0 ? INT_TYPE : FLOAT_TYPE;
     }
 };
 
@@ -263,42 +305,102 @@ class UnaryOp : public AST
 {
 
 public:
-    Token token, op;
+    Token op;
     boostvar expr;
+    StaticType type;
 
     UnaryOp(Token op, boostvar expr)
     {
-        this->token = op;
         this->op = op;
         this->expr = expr;
+        this->type = UNKNOWN_TYPE;
     }
 };
 
+//An expression that does not change while a loop runs, evaluated once and kept in a frame slot
+class Invariant : public AST
+{
+
+public:
+    boostvar expr;
+    int slot;
+    StaticType type;
+
+    Invariant(boostvar expr, int slot, StaticType type)
+    {
+        this->expr = expr;
+        this->slot = slot;
+        this->type = type;
+    }
+};
+
+StaticType static_type(boostvar node)
+{
+    switch (node.which())
+    {
+    case 0: return boost::get<BinOp*>(node)->type;
+    case 1: return boost::get<Num*>(node)->type;
+    case 2: return boost::get<UnaryOp*>(node)->type;
+    case 5: return boost::get<Var*>(node)->type;
+    case 21: return STRING_TYPE;
+    case 22: return boost::get<Invariant*>(node)->type;
+    default: return UNKNOWN_TYPE;
+    }
+}
+
 class Parser
 {
 
 public: 
     Lexer lexer;
     Token current_token;
+    Arena* arena; //owns every node of the parsed program
 
 private:
-    void error(string error_code, Token token, string error_message = "")
+    [[noreturn]] void error(string error_code, Token token, string error_message = "")
     {
-        cout << "ERROR:: "<<error_code << "->" << token <<" line:: "<< lexer.lineno <<":"<<lexer.column << error_message << endl;
-        _Exit(10);
+        pair<int, int> where = lexer.location(token.pos);
+        ostringstream message;
+        message << error_code << "->" << token << " line:: " << where.first << ":" << where.second << error_message;
+        fail(message.str());
     }
 
-    void eat(string type)
+    void eat(TokenType type)
     {
         if (current_token.type == type)
             current_token = this->lexer.get_next_token();
         else
         {
-            string error_message = "\nExpected type: " + type;
+            string error_message = "\nExpected type: " + string(TOKEN_TYPE_NAMES[type]);
             error("UNEXPECTED_TOKEN", current_token, error_message);
         }
     }
 
+    Value decode_number(Token token)
+    {
+        const char* first = token.value.data();
+        const char* last = first + token.value.size();
+        from_chars_result result;
+        Value constant;
+
+        if (token.type == INTEGER_CONST)
+        {
+            int value = 0;
+            result = from_chars(first, last, value);
+            constant = value;
+        }
+        else
+        {
+            float value = 0;
+            result = from_chars(first, last, value);
+            constant = value;
+        }
+
+        if (result.ec != errc())
+            error("INVALID_NUMBER", token);
+        return constant;
+    }
+
     boostvar atom()
     {
         //atom: (PLUS | MINUS) atom | INTEGER_CONST | REAL_CONST | LPAREN expr RPAREN | variable 
@@ -306,22 +408,24 @@ private:
         if (token.type == PLUS)
         {
             eat(PLUS);
-            return new UnaryOp(token, atom());
+            return arena->make<UnaryOp>(token, atom());
         }
         else if (token.type == MINUS)
         {
             eat(MINUS);
-            return new UnaryOp(token, atom());
+            return arena->make<UnaryOp>(token, atom());
         }
         else if (token.type == INTEGER_CONST)
         {
+            Value constant = decode_number(token); //while the lexer still holds the token
             eat(INTEGER_CONST);
-            return new Num(token);
+            return arena->make<Num>(token, constant);
         }
         else if (token.type == REAL_CONST)
         {
+            Value constant = decode_number(token);
             eat(REAL_CONST);
-            return new Num(token);
+            return arena->make<Num>(token, constant);
         }
         else if (token.type == LPAREN) {
             eat(LPAREN);
@@ -346,7 +450,7 @@ private:
         {
             Token token = current_token;
             eat(POW);
-            node = new BinOp(node, token, factor());
+            node = arena->make<BinOp>(node, token, factor());
         }
 
         return node;
@@ -368,7 +472,7 @@ private:
             else
                 eat(FLOAT_DIV);
 
-            node = new BinOp(node, token, factor());
+            node = arena->make<BinOp>(node, token, factor());
         }
 
         return node;
@@ -387,7 +491,7 @@ private:
             else
                 eat(MINUS);
 
-            node = new BinOp(node, token, term());
+            node = arena->make<BinOp>(node, token, term());
         }
 
         return node;
@@ -395,12 +499,12 @@ private:
 
     boostvar empty() {
         //An empty production
-        return new NoOp();
+        return arena->make<NoOp>();
     }
 
     boostvar variable() {
         //variable: ID
-        boostvar node = new Var(current_token);
+        boostvar node = arena->make<Var>(current_token);
         eat(ID);
         return node;
     }
@@ -412,7 +516,7 @@ private:
         Token token = current_token;
         eat(ASSIGN);
         boostvar right = expr();
-        boostvar node = new Assign(left, token, right);
+        boostvar node = arena->make<Assign>(left, token, right);
         return node;
     }
 
@@ -426,21 +530,23 @@ private:
             eat(current_token.type);
             msg += " ";
         }
-        return new Message(msg);
+        return arena->make<Message>(msg);
     }
 
     boostvar read_statement()
     {
         //read_statement: READ variable
+        Token token = current_token;
         eat(READ);
         boostvar var = variable();
-        boostvar node = new Read(var);
+        boostvar node = arena->make<Read>(var, token.pos);
         return node;
     }
 
     boostvar print_statement()
     {
         //print_statement: PRINT (message | expr) (SEP expr | message)*
+        Token token = current_token;
         eat(PRINT);
         vector<boostvar> messages = {};
   
@@ -464,13 +570,14 @@ private:
             else messages.push_back(expr());
         }
        
-        boostvar node = new Print(messages);
+        boostvar node = arena->make<Print>(messages, token.pos);
         return node;
     }
 
     boostvar conditional_statement()
     {
         //conditional_statement : IF LPAREN expr RPAREN COLON statement_list ENDIF
+        Token token = current_token;
         eat(IF);
         eat(LPAREN);
         boostvar condition_node = expr();
@@ -485,13 +592,14 @@ private:
             else_statements = statement_list();
         }
         eat(ENDIF);
-        boostvar node = new Condition(condition_node, if_statements, else_statements);
+        boostvar node = arena->make<Condition>(condition_node, if_statements, else_statements, token.pos);
         return node;
     }
 
     boostvar loop_statement()
     {
         //loop_statement: WHILE LPAREN expr RPAREN COLON statement_list ENDWHILE
+        Token token = current_token;
         eat(WHILE);
         eat(LPAREN);
         boostvar condition_node = expr();
@@ -500,7 +608,7 @@ private:
         vector<boostvar> statements = statement_list();
         eat(ENDWHILE);
 
-        boostvar node = new Loop(condition_node, statements);
+        boostvar node = arena->make<Loop>(condition_node, statements, token.pos);
         return node;
     }
 
@@ -557,7 +665,7 @@ private:
         vector<boostvar> nodes = statement_list();
         eat(END);
 
-        Compound* root = new Compound();
+        Compound* root = arena->make<Compound>();
         for (auto node : nodes)
             root->children.push_back(node);
         return root;
@@ -572,7 +680,7 @@ private:
         else
             eat(REAL);
 
-        boostvar node = new Type(token);
+        boostvar node = arena->make<Type>(token);
         return node;
     }
 
@@ -582,13 +690,13 @@ private:
         vector<boostvar> var_nodes;
 
         //storing the first ID
-        var_nodes.push_back(new Var(current_token));
+        var_nodes.push_back(arena->make<Var>(current_token));
         eat(ID);
 
         while (current_token.type == COMMA)
         {
             eat(COMMA);
-            var_nodes.push_back(new Var(current_token));
+            var_nodes.push_back(arena->make<Var>(current_token));
             eat(ID);
         }
 
@@ -598,7 +706,7 @@ private:
         vector<boostvar> var_declarations;
 
         for (auto var_node : var_nodes)
-            var_declarations.push_back(new VarDecl(var_node, type_node));
+            var_declarations.push_back(arena->make<VarDecl>(var_node, type_node));
 
         return var_declarations;
     }
@@ -620,7 +728,7 @@ private:
 
         eat(SEMI);
         boostvar block_node = block();
-        boostvar proc_decl = new ProcedureDecl(proc_name, block_node, params);
+        boostvar proc_decl = arena->make<ProcedureDecl>(proc_name, block_node, params);
         eat(SEMI);
 
         return proc_decl;
@@ -651,7 +759,7 @@ private:
 
         eat(RPAREN);
 
-        boostvar node = new ProcedureCall(proc_name, actual_params, token);
+        boostvar node = arena->make<ProcedureCall>(proc_name, actual_params, token);
 
         return node;
     }
@@ -701,7 +809,7 @@ private:
 
         for (auto param_token : param_tokens)
         {
-            boostvar param_node = new Param(new Var(param_token), type_node);
+            boostvar param_node = arena->make<Param>(arena->make<Var>(param_token), type_node);
             param_nodes.push_back(param_node);
         }
 
@@ -731,7 +839,7 @@ private:
         //block : declarations compound_statement
         vector<boostvar> declaration_nodes = declarations();
         boostvar compound_statement_node = compound_statement();
-        boostvar node = new Block(declaration_nodes, compound_statement_node);
+        boostvar node = arena->make<Block>(declaration_nodes, compound_statement_node);
         return node;
     }
 
@@ -743,18 +851,22 @@ private:
         string program_name = var_node->value;
         eat(SEMI);
         boostvar block_node = block();
-        boostvar program_node = new Program(program_name, block_node);
+        boostvar program_node = arena->make<Program>(program_name, block_node);
         eat(DOT);
         return program_node;
     }
 
 
 public:
-    Parser() {}
+    Parser()
+    {
+        this->arena = NULL;
+    }
 
-    Parser(Lexer lexer)
+    Parser(Lexer lexer, Arena* arena)
     {
         this->lexer = lexer;
+        this->arena = arena;
         this->current_token = this->lexer.get_next_token();
     }
 
@@ -0,0 +1,190 @@
+#pragma once
+#include "symbol.h"
+#include <chrono>
+#include <iomanip>
+#include <map>
+
+/* ###############################
+   #        PROFILER             #
+   ###############################
+*/
+
+//Counts and times of one statement or procedure, times are in nanoseconds
+struct ProfileEntry
+{
+    string name;        //procedure name, empty for statements
+    size_t pos;         //source offset of the statement or declaration
+    long long count;
+    long long inclusive; //time until it finished, including what it ran
+    long long exclusive; //inclusive minus the time of nested entries of the same kind
+    int active;          //activations still running, recursion only adds the outermost one to inclusive
+
+    ProfileEntry(string name = "", size_t pos = 0)
+    {
+        this->name = name;
+        this->pos = pos;
+        this->count = this->inclusive = this->exclusive = 0;
+        this->active = 0;
+    }
+};
+
+/*
+   Entries that are running, innermost last. The time an activation spends in nested
+   activations is collected in 'nested' so that it can be left out of its exclusive time.
+*/
+class ProfileStack
+{
+    struct Activation
+    {
+        ProfileEntry* entry;
+        chrono::steady_clock::time_point start;
+        long long nested;
+    };
+    vector<Activation> running;
+
+public:
+    void enter(ProfileEntry* entry)
+    {
+        entry->count++;
+        entry->active++;
+        running.push_back({ entry, chrono::steady_clock::now(), 0 });
+    }
+
+    void leave()
+    {
+        Activation activation = running.back();
+        running.pop_back();
+        long long elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - activation.start).count();
+
+        ProfileEntry* entry = activation.entry;
+        entry->exclusive += elapsed - activation.nested;
+        if (--entry->active == 0)
+            entry->inclusive += elapsed;
+        if (!running.empty())
+            running.back().nested += elapsed;
+    }
+};
+
+/*
+   Collects what --profile reports. The interpreter times every statement it executes
+   (assignments, PRINT, READ, calls, IF and WHILE) and every procedure activation, the
+   main program counting as one. A statement's exclusive time leaves out the statements
+   it runs, a WHILE loop's is the time spent on its condition; a procedure's leaves out
+   the procedures it calls. Expressions are not timed on their own, their cost shows up
+   in the statement evaluating them. A loop or procedure the JIT has compiled is timed as
+   a whole by the statement or call that runs it.
+*/
+class Profiler
+{
+    unordered_map<const void*, ProfileEntry> statements;
+    unordered_map<ProcedureSymbol*, ProfileEntry> procedures;
+    ProfileEntry program;
+    ProfileStack statement_stack;
+    ProfileStack procedure_stack;
+
+public:
+    static bool is_statement(boostvar node)
+    {
+        int kind = node.which();
+        return kind == 4 || (kind >= 16 && kind <= 20);
+    }
+
+    void enter_statement(boostvar node)
+    {
+        const void* key;
+        size_t pos;
+        switch (node.which())
+        {
+        case 4: key = boost::get<Assign*>(node); pos = boost::get<Assign*>(node)->op.pos; break;
+        case 16: key = boost::get<Print*>(node); pos = boost::get<Print*>(node)->pos; break;
+        case 17: key = boost::get<ProcedureCall*>(node); pos = boost::get<ProcedureCall*>(node)->token.pos; break;
+        case 18: key = boost::get<Read*>(node); pos = boost::get<Read*>(node)->pos; break;
+        case 19: key = boost::get<Condition*>(node); pos = boost::get<Condition*>(node)->pos; break;
+        default: key = boost::get<Loop*>(node); pos = boost::get<Loop*>(node)->pos; break;
+        }
+
+        auto found = statements.find(key);
+        if (found == statements.end())
+            found = statements.emplace(key, ProfileEntry("", pos)).first;
+        statement_stack.enter(&found->second);
+    }
+
+    void leave_statement()
+    {
+        statement_stack.leave();
+    }
+
+    void enter_program(Program* node)
+    {
+        program.name = node->name;
+        procedure_stack.enter(&program);
+    }
+
+    void enter_procedure(ProcedureSymbol* proc_symbol)
+    {
+        auto found = procedures.find(proc_symbol);
+        if (found == procedures.end())
+            found = procedures.emplace(proc_symbol, ProfileEntry(proc_symbol->name)).first;
+        procedure_stack.enter(&found->second);
+    }
+
+    void leave_procedure()
+    {
+        procedure_stack.leave();
+    }
+
+    //Statements are reported per source line, the lexer turns offsets into line numbers
+    void print_report(ostream& out, Lexer& lexer, int top = 20)
+    {
+        map<int, ProfileEntry> lines;
+        for (auto& statement : statements)
+        {
+            int line = lexer.location(statement.second.pos).first;
+            ProfileEntry& total = lines[line];
+            total.pos = line;
+            total.count += statement.second.count;
+            total.inclusive += statement.second.inclusive;
+            total.exclusive += statement.second.exclusive;
+        }
+        vector<ProfileEntry> hot_lines;
+        for (auto& line : lines)
+            hot_lines.push_back(line.second);
+
+        vector<ProfileEntry> hot_procedures = { program };
+        for (auto& procedure : procedures)
+            hot_procedures.push_back(procedure.second);
+
+        long long total = max(program.inclusive, 1LL);
+        out << "PROFILE " << program.name << ": " << fixed << setprecision(3) << program.inclusive / 1e6 << " ms" << endl;
+
+        out << endl << "Hot lines (by exclusive time):" << endl;
+        out << setw(8) << "line" << setw(12) << "count" << setw(14) << "incl ms" << setw(14) << "excl ms" << setw(9) << "excl %" << endl;
+        print_entries(out, hot_lines, top, total, [](ostream& out, const ProfileEntry& entry) {
+            out << setw(8) << entry.pos;
+        });
+
+        out << endl << "Hot procedures (by exclusive time):" << endl;
+        out << setw(20) << left << "  procedure" << right << setw(12) << "calls" << setw(14) << "incl ms" << setw(14) << "excl ms" << setw(9) << "excl %" << endl;
+        print_entries(out, hot_procedures, top, total, [](ostream& out, const ProfileEntry& entry) {
+            out << "  " << setw(18) << left << entry.name << right;
+        });
+        out.unsetf(ios::floatfield);
+        out << setprecision(6);
+    }
+
+private:
+    template<typename Label>
+    void print_entries(ostream& out, vector<ProfileEntry>& entries, int top, long long total, Label label)
+    {
+        sort(entries.begin(), entries.end(), [](const ProfileEntry& a, const ProfileEntry& b) {
+            return a.exclusive != b.exclusive ? a.exclusive > b.exclusive : a.pos < b.pos;
+        });
+        for (int i = 0; i < (int)entries.size() && i < top; i++)
+        {
+            const ProfileEntry& entry = entries[i];
+            label(out, entry);
+            out << setw(12) << entry.count << setw(14) << entry.inclusive / 1e6 << setw(14) << entry.exclusive / 1e6
+                << setw(8) << 100.0 * entry.exclusive / total << "%" << endl;
+        }
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include "cache.h"
+#include "closure.h"
+#include "optimizer.h"
+#include "stats.h"
+
+/* ###############################
+   #        RUNNER               #
+   ###############################
+*/
+
+//How to run a program, as given on the command line
+class RunOptions
+{
+
+public:
+    string engine;
+    bool stream;
+    bool optimize;
+    bool optimizer_report;
+    bool profile;
+    string stats;               //"text" or "json" when --stats is given
+    string cache_directory;
+    int jit_threshold;
+    int max_depth;
+
+    RunOptions()
+    {
+        this->engine = "tree";
+        this->stream = false;
+        this->optimize = true;
+        this->optimizer_report = false;
+        this->profile = false;
+        this->stats = "";
+        this->cache_directory = "";
+        this->jit_threshold = 1000;
+        this->max_depth = DEFAULT_MAX_DEPTH;
+    }
+
+    //What is wrong with this combination of options, empty when nothing is
+    string problem()
+    {
+        if (engine != "tree" && engine != "vm" && engine != "closure" && engine != "jit")
+            return "Unknown engine '" + engine + "', expected tree, vm, closure or jit";
+        if (profile && engine != "tree" && engine != "jit")
+            return "--profile needs the tree or jit engine";
+        if (!cache_directory.empty() && engine != "vm")
+            return "--cache needs the vm engine";
+        if (!cache_directory.empty() && stream)
+            return "--cache needs a program file that is not streamed";
+        return "";
+    }
+};
+
+/*
+   Runs one program from its file through the whole pipeline on the engine the options
+   name. Everything the program reads and prints goes through 'context', the reports of
+   --profile, --stats and --optimizer-report go to 'report'. An error anywhere ends the
+   run with ProgramError. Nothing here is shared between calls, so runs on different
+   threads only need a context and a report stream each.
+*/
+void run_file(const string& file_name, const RunOptions& options, RunContext& context, ostream& report)
+{
+    Statistics statistics;
+
+    //"-" reads the program from stdin, --stream reads a file in chunks instead of mapping it
+    unique_ptr<SourceFile> source;
+    Lexer lexer;
+    if (file_name == "-")
+        lexer = Lexer(0);
+    else if (options.stream)
+        lexer = Lexer(open_source_fd(file_name), true);
+    else
+    {
+        source.reset(new SourceFile(file_name));
+        lexer = Lexer(source->text());
+    }
+    if (options.profile)
+        lexer.keep_line_index();
+
+    //--cache skips everything up to running the VM when this source was compiled before
+    unique_ptr<ProgramCache> cache;
+    unique_ptr<BytecodeProgram> program;
+    if (!options.cache_directory.empty())
+    {
+        if (!source)
+            fail("--cache needs a program file that is not streamed");
+        statistics.begin("load");
+        cache.reset(new ProgramCache(options.cache_directory, source->text(), options.optimize));
+        program.reset(cache->load());
+        statistics.end();
+    }
+
+    Arena arena;
+    Parser parser;
+    boostvar tree;
+    if (!program)
+    {
+        statistics.begin("parse");
+        parser = Parser(lexer, &arena);
+        tree = parser.parse();
+        statistics.end();
+        if (!options.stats.empty())
+            statistics.record_parse(parser.lexer, tree);
+
+        Optimizer optimizer(&arena);
+        if (options.optimize)
+        {
+            statistics.begin("prune");
+            optimizer.eliminate_dead_code(tree);
+        }
+        statistics.begin("analyze");
+        SemanticAnalyzer semantic_analyser(&arena);
+        semantic_analyser.visit(tree);
+        statistics.record_analysis(semantic_analyser);
+        if (options.optimize)
+        {
+            statistics.begin("optimize");
+            optimizer.optimize(tree);
+            statistics.end();
+            if (options.optimizer_report)
+                optimizer.print_report(report);
+        }
+    }
+    Profiler profiler;
+    Profiler* active_profiler = options.profile ? &profiler : NULL;
+    if (options.engine == "vm")
+    {
+        if (!program)
+        {
+            statistics.begin("compile");
+            BytecodeCompiler compiler;
+            program.reset(compiler.compile(tree));
+            if (cache)
+            {
+                statistics.begin("store");
+                cache->store(program.get());
+            }
+        }
+        statistics.begin("run");
+        VM vm(program.get(), &context, options.max_depth);
+        vm.run();
+        statistics.record_run(vm.frame_stack(), context);
+    }
+    else if (options.engine == "closure")
+    {
+        statistics.begin("compile");
+        ClosureCompiler compiler;
+        ClosureProcedure* main_procedure = compiler.compile(tree);
+        statistics.begin("run");
+        ClosureEngine closure_engine(main_procedure, &context, options.max_depth);
+        closure_engine.run();
+        statistics.record_run(closure_engine.frame_stack(), context);
+    }
+    else if (options.engine == "jit")
+    {
+        statistics.begin("run");
+        Jit jit(&context, options.jit_threshold);
+        Interpreter interpreter(tree, &context, &jit, options.max_depth, active_profiler);
+        interpreter.interpret();
+        statistics.record_run(interpreter.frame_stack(), context);
+    }
+    else
+    {
+        statistics.begin("run");
+        Interpreter interpreter(tree, &context, NULL, options.max_depth, active_profiler);
+        interpreter.interpret();
+        statistics.record_run(interpreter.frame_stack(), context);
+    }
+    statistics.end();
+    context.output.write_line("Your code has been Interpreted successfully!");
+    context.output.flush();
+    if (options.profile)
+        profiler.print_report(report, parser.lexer);
+    if (options.stats == "text")
+        statistics.print_text(report);
+    else if (options.stats == "json")
+        statistics.print_json(report);
+}
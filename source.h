@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include "error.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* ###############################
+   #        SOURCE FILE          #
+   ###############################
+*/
+
+/*
+   Maps the program file into memory so the lexer can slice it without copying.
+   Where mmap is not available the file is read in one go instead.
+*/
+class SourceFile
+{
+    const char* data;
+    size_t length;
+    bool mapped;
+    std::string buffer; //only used when the file could not be mapped
+
+public:
+    SourceFile(const std::string& path)
+    {
+        this->data = NULL;
+        this->length = 0;
+        this->mapped = false;
+
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            error(path);
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            void* address = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                this->data = static_cast<const char*>(address);
+                this->length = info.st_size;
+                this->mapped = true;
+                madvise(address, info.st_size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (mapped)
+            return;
+#endif
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            error(path);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        this->buffer = contents.str();
+        this->data = buffer.data();
+        this->length = buffer.size();
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    ~SourceFile()
+    {
+#ifndef _WIN32
+        if (mapped)
+            munmap(const_cast<char*>(data), length);
+#endif
+    }
+
+    [[noreturn]] void error(const std::string& path)
+    {
+        fail("Could not open file '" + path + "'");
+    }
+
+    std::string_view text() const
+    {
+        return std::string_view(data, length);
+    }
+};
+
+//File descriptor for streaming a program through the lexer
+int open_source_fd(const std::string& path)
+{
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+#endif
+    if (fd < 0)
+        fail("Could not open file '" + path + "'");
+    return fd;
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include "optimizer.h"
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+
+/* ###############################
+   #        STATISTICS           #
+   ###############################
+*/
+
+//Names of the node kinds, indexed by which()
+const char* NODE_KIND_NAMES[] = {
+    "BinOp", "Num", "UnaryOp", "Compound", "Assign", "Var", "NoOp", "Program", "Block", "VarDecl",
+    "Type", "BuiltinTypeSymbol", "VarSymbol", "ProcedureDecl", "Param", "ProcedureSymbol", "Print",
+    "ProcedureCall", "Read", "Condition", "Loop", "Message", "Invariant"
+};
+const int NODE_KINDS = sizeof(NODE_KIND_NAMES) / sizeof(NODE_KIND_NAMES[0]);
+
+struct PhaseTime
+{
+    string name;
+    double wall_ms;
+    double cpu_ms;
+};
+
+/*
+   What --stats reports about one run. main times every phase, the other figures
+   are read off the lexer, the tree, the SemanticAnalyzer and the engine's FrameStack
+   once they are done, so collecting them costs nothing while the program runs
+   beyond the counters those keep anyway.
+*/
+class Statistics
+{
+    vector<PhaseTime> phases;
+    bool timing;
+    chrono::steady_clock::time_point wall_start;
+    clock_t cpu_start;
+
+public:
+    size_t tokens;
+    size_t source_bytes;
+    int ast_nodes;
+    vector<int> nodes_by_kind;
+    int scopes;
+    int symbols;
+    int largest_scope;
+    long long calls;
+    long long loop_iterations;
+    int peak_depth;
+    size_t input_bytes;
+    size_t output_bytes;
+
+    Statistics()
+    {
+        this->timing = false;
+        this->tokens = this->source_bytes = 0;
+        this->ast_nodes = 0;
+        this->nodes_by_kind.assign(NODE_KINDS, 0);
+        this->scopes = this->symbols = this->largest_scope = 0;
+        this->calls = this->loop_iterations = 0;
+        this->peak_depth = 0;
+        this->input_bytes = this->output_bytes = 0;
+    }
+
+    //Ends the phase being timed, if any, and starts timing the next one
+    void begin(string phase)
+    {
+        end();
+        phases.push_back({ phase, 0, 0 });
+        timing = true;
+        wall_start = chrono::steady_clock::now();
+        cpu_start = clock();
+    }
+
+    void end()
+    {
+        if (!timing)
+            return;
+        timing = false;
+        phases.back().wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - wall_start).count();
+        phases.back().cpu_ms = 1000.0 * (clock() - cpu_start) / CLOCKS_PER_SEC;
+    }
+
+    void record_parse(Lexer& lexer, boostvar tree)
+    {
+        tokens = lexer.tokens;
+        source_bytes = lexer.offset();
+        ast_nodes = count_nodes(tree, &nodes_by_kind);
+    }
+
+    void record_analysis(SemanticAnalyzer& analyzer)
+    {
+        scopes = analyzer.scopes;
+        symbols = analyzer.symbols;
+        largest_scope = analyzer.largest_scope;
+    }
+
+    void record_run(FrameStack& frames, RunContext& context)
+    {
+        calls = frames.calls;
+        loop_iterations = frames.loop_iterations;
+        peak_depth = frames.peak_depth;
+        input_bytes = context.input.bytes_read;
+        output_bytes = context.output.printed_bytes;
+    }
+
+    void print_text(ostream& out)
+    {
+        end();
+        double wall_total = 0, cpu_total = 0;
+        out << "STATISTICS" << endl;
+        out << fixed << setprecision(3);
+        out << "  " << setw(10) << left << "phase" << right << setw(12) << "wall ms" << setw(12) << "cpu ms" << endl;
+        for (PhaseTime& phase : phases)
+        {
+            out << "  " << setw(10) << left << phase.name << right << setw(12) << phase.wall_ms << setw(12) << phase.cpu_ms << endl;
+            wall_total += phase.wall_ms;
+            cpu_total += phase.cpu_ms;
+        }
+        out << "  " << setw(10) << left << "total" << right << setw(12) << wall_total << setw(12) << cpu_total << endl;
+        out.unsetf(ios::floatfield);
+        out << setprecision(6);
+
+        out << "tokens: " << tokens << " from " << source_bytes << " source bytes" << endl;
+        out << "AST nodes: " << ast_nodes;
+        vector<int> kinds = kinds_by_count();
+        for (size_t i = 0; i < kinds.size(); i++)
+            out << (i == 0 ? " (" : ", ") << NODE_KIND_NAMES[kinds[i]] << " " << nodes_by_kind[kinds[i]];
+        out << (kinds.empty() ? "" : ")") << endl;
+        out << "symbol tables: " << scopes << " scopes, " << symbols << " symbols, largest scope " << largest_scope << endl;
+        out << "procedure calls: " << calls << ", peak call depth " << peak_depth << endl;
+        out << "loop iterations: " << loop_iterations << endl;
+        out << "READ input: " << input_bytes << " bytes, PRINT output: " << output_bytes << " bytes" << endl;
+    }
+
+    void print_json(ostream& out)
+    {
+        end();
+        out << "{" << endl;
+        out << "  \"phases\": [";
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            out << (i == 0 ? "" : ",") << endl << "    { \"name\": \"" << phases[i].name << "\", \"wall_ms\": " << phases[i].wall_ms
+                << ", \"cpu_ms\": " << phases[i].cpu_ms << " }";
+        }
+        out << endl << "  ]," << endl;
+        out << "  \"tokens\": " << tokens << "," << endl;
+        out << "  \"source_bytes\": " << source_bytes << "," << endl;
+        out << "  \"ast_nodes\": { \"total\": " << ast_nodes;
+        for (int kind : kinds_by_count())
+            out << ", \"" << NODE_KIND_NAMES[kind] << "\": " << nodes_by_kind[kind];
+        out << " }," << endl;
+        out << "  \"symbol_tables\": { \"scopes\": " << scopes << ", \"symbols\": " << symbols << ", \"largest_scope\": " << largest_scope << " }," << endl;
+        out << "  \"procedure_calls\": " << calls << "," << endl;
+        out << "  \"peak_call_depth\": " << peak_depth << "," << endl;
+        out << "  \"loop_iterations\": " << loop_iterations << "," << endl;
+        out << "  \"input_bytes\": " << input_bytes << "," << endl;
+        out << "  \"output_bytes\": " << output_bytes << endl;
+        out << "}" << endl;
+    }
+
+private:
+    //Kinds that occur in the tree, most frequent first
+    vector<int> kinds_by_count()
+    {
+        vector<int> kinds;
+        for (int kind = 0; kind < NODE_KINDS; kind++)
+        {
+            if (nodes_by_kind[kind] > 0)
+                kinds.push_back(kind);
+        }
+        stable_sort(kinds.begin(), kinds.end(), [this](int a, int b) { return nodes_by_kind[a] > nodes_by_kind[b]; });
+        return kinds;
+    }
+};
@@ -48,11 +48,21 @@ class VarSymbol : public Symbol
 {
 
 public:
+    int slot;
+    StaticType value_type; //join of everything stored into the variable, see TypeInference
+
 	VarSymbol(string name, boostvar type)
 	{
         this->name = name;
         this->type = type;
+        this->slot = -1;
+        this->value_type = is_integer() ? INT_TYPE : NO_TYPE;
 	}
+
+    bool is_integer()
+    {
+        return type.which() == 11 && boost::get<BuiltinTypeSymbol*>(type)->name == "INTEGER";
+    }
 };
 
 ostream& operator<<(ostream& strm, const VarSymbol& varSymbol) {
@@ -66,13 +76,23 @@ public:
     string name;
     vector<boostvar> params;
     boostvar block_node;
+    int inherited;  //slots numbered before the procedure's own, they belong to the enclosing scopes
+    int frame_size; //inherited + params + locals
+
     ProcedureSymbol(string name, vector<boostvar>params) 
     {
         this->name = name;
         this->params = params;
+        this->inherited = 0;
+        this->frame_size = 0;
     }
 };
 
+/*
+   A scope only holds the symbols declared in it and points at the scope it is nested in,
+   so a lookup walks up the chain without copying anything. The chain always ends in the
+   builtin scope, which holds the INTEGER and REAL type symbols shared by every program.
+*/
 class ScopedSymbolTable
 {
 
@@ -80,25 +100,24 @@ public:
     unordered_map<string, boostvar> symbols;
     string scope_name;
     int scope_level;
+    int frame_size; //slots used so far, a scope numbers its slots on from its enclosing scope
+    ScopedSymbolTable* enclosing_scope;
 
-    //ScopedSymbolTable() {}
-
-    ScopedSymbolTable(string scope_name, int scope_level) {
+    ScopedSymbolTable(string scope_name, int scope_level, ScopedSymbolTable* enclosing_scope, int frame_size = 0) {
         this->scope_name = scope_name;
         this->scope_level = scope_level;
-        _init_builtins();
+        this->enclosing_scope = enclosing_scope;
+        this->frame_size = frame_size;
     }
 
-    void _init_builtins()
+    int allocate_slot()
     {
-        insert(new BuiltinTypeSymbol("INTEGER"));
-        insert(new BuiltinTypeSymbol("REAL"));
+        return frame_size++;
     }
 
-    void error(string error_code, string name)
+    [[noreturn]] void error(string error_code, string name)
     {
-        cout <<"ERROR:: "<< error_code << " -> (ID, " << name << ")" << endl;
-        _Exit(10);
+        fail(error_code + " -> (ID, " + name + ")");
     }
 
     void insert(boostvar symbol)
@@ -123,7 +142,19 @@ public:
         }
     }
 
-    boostvar lookup(string name, bool procedue_check = false);
+    boostvar lookup(const string& name, bool procedure_check = false)
+    {
+        for (ScopedSymbolTable* scope = this; scope; scope = scope->enclosing_scope)
+        {
+            auto found = scope->symbols.find(name);
+            if (found != scope->symbols.end())
+                return found->second;
+        }
+
+        if (procedure_check)
+            fail("No such function named '" + name + "' exists.");
+        else error("Variable not found", name);
+    }
 }; 
 
 ostream& operator<<(ostream& strm, const ScopedSymbolTable& symbolTable) {
@@ -133,43 +164,229 @@ ostream& operator<<(ostream& strm, const ScopedSymbolTable& symbolTable) {
 	return strm << "Symbols: {" + information;
 }
 
-stack<ScopedSymbolTable> enclosed_scopes;
+//Root of every scope chain, built once and only read afterwards
+ScopedSymbolTable* builtin_scope()
+{
+    static BuiltinTypeSymbol integer_type("INTEGER");
+    static BuiltinTypeSymbol real_type("REAL");
+    static ScopedSymbolTable scope = [] {
+        ScopedSymbolTable builtins("BUILTIN", 0, NULL);
+        builtins.insert(&integer_type);
+        builtins.insert(&real_type);
+        return builtins;
+    }();
+    return &scope;
+}
 
-boostvar ScopedSymbolTable :: lookup(string name, bool procedure_check)
+/* ###############################
+   #       TYPE INFERENCE        #
+   ###############################
+*/
+
+/*
+   Works out which variables can only ever hold an INTEGER or only a REAL value and
+   annotates every expression with the type it produces. An INTEGER variable is
+   always an int; a REAL one gets the join of everything assigned, read or passed
+   into it over the whole program, repeated until nothing changes. Checks that
+   reject a REAL for an INTEGER target are kept only where the value may be REAL.
+*/
+class TypeInference
 {
-    //cout << "Lookup: " << name << endl;
-    if (symbols.find(name) != symbols.end())
+    bool changed;
+    bool annotating;
+
+public:
+    TypeInference()
     {
-        boostvar symbol = symbols[name];
-        return symbol;
+        this->changed = false;
+        this->annotating = false;
     }
 
-    if (enclosed_scopes.size() > 1) 
+    void infer(Program* program)
     {
-        ScopedSymbolTable enclosed_scope = enclosed_scopes.top();
-        enclosed_scopes.pop();
-        boostvar symbol = enclosed_scope.lookup(name);
-        enclosed_scopes.push(enclosed_scope);
-        return symbol;
+        do
+        {
+            changed = false;
+            visit(program->block);
+        } while (changed);
+
+        annotating = true;
+        visit(program->block);
     }
 
-    if (procedure_check)
+    static StaticType join(StaticType a, StaticType b)
     {
-        cout << "ERROR:: No such function named '" << name<< "' exists." << endl;
-        _Exit(10);
+        if (a == NO_TYPE) return b;
+        if (b == NO_TYPE || a == b) return a;
+        return UNKNOWN_TYPE;
     }
-    else error("Variable not found", name);
-}
+
+private:
+    //INTEGER variables only ever keep ints, storing a REAL into one is an error
+    void store(VarSymbol* symbol, StaticType type)
+    {
+        if (symbol->is_integer())
+            return;
+        StaticType joined = join(symbol->value_type, type);
+        if (joined != symbol->value_type)
+        {
+            symbol->value_type = joined;
+            changed = true;
+        }
+    }
+
+    //NO_TYPE means the expression reads a variable that never gets a value, so it always fails
+    StaticType type_of(boostvar node)
+    {
+        StaticType type;
+        switch (node.which())
+        {
+        case 0:
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            StaticType left = type_of(bin_op->left), right = type_of(bin_op->right);
+            if (left == NO_TYPE || right == NO_TYPE)
+                type = NO_TYPE;
+            else if (left == UNKNOWN_TYPE || right == UNKNOWN_TYPE)
+                type = UNKNOWN_TYPE;
+            else if (bin_op->op.type == POW)
+                type = right == INT_TYPE ? INT_TYPE : UNKNOWN_TYPE;
+            else if (left != right)
+                type = UNKNOWN_TYPE;    //mixed operands fail at run time
+            else
+                type = bin_op->op.type == INTEGER_DIV ? INT_TYPE : left;
+            if (annotating)
+                bin_op->type = type == NO_TYPE ? UNKNOWN_TYPE : type;
+            return type;
+        }
+        case 1:
+            return boost::get<Num*>(node)->type;
+        case 2:
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            type = type_of(unary_op->expr);
+            if (annotating)
+                unary_op->type = type == NO_TYPE ? UNKNOWN_TYPE : type;
+            return type;
+        }
+        case 5:
+        {
+            Var* var = boost::get<Var*>(node);
+            type = var->symbol->value_type;
+            if (annotating)
+                var->type = type == NO_TYPE ? UNKNOWN_TYPE : type;
+            return type;
+        }
+        case 21:
+            return STRING_TYPE;
+        default:
+            return UNKNOWN_TYPE;
+        }
+    }
+
+    void visit(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 3:
+            for (auto child : boost::get<Compound*>(node)->children)
+                visit(child);
+            break;
+        case 4:
+        {
+            Assign* assign = boost::get<Assign*>(node);
+            Var* target = boost::get<Var*>(assign->left);
+            StaticType type = type_of(assign->right);
+            store(target->symbol, type);
+            if (annotating)
+            {
+                type_of(assign->left);
+                assign->integer_target = target->symbol->is_integer() && type != INT_TYPE;
+            }
+            break;
+        }
+        case 8:
+        {
+            Block* block = boost::get<Block*>(node);
+            for (auto declaration : block->declarations)
+            {
+                if (declaration.which() == 13)
+                    visit(boost::get<ProcedureDecl*>(declaration)->block_node);
+            }
+            visit(block->compound_statement);
+            break;
+        }
+        case 16:
+            for (auto message : boost::get<Print*>(node)->messages)
+                type_of(message);
+            break;
+        case 17:
+        {
+            ProcedureCall* call = boost::get<ProcedureCall*>(node);
+            if (annotating)
+                call->integer_checks.assign(call->actual_params.size(), 0);
+            for (size_t i = 0; i < call->actual_params.size(); i++)
+            {
+                StaticType type = type_of(call->actual_params[i]);
+                if (call->proc_symbol == NULL || i >= call->proc_symbol->params.size())
+                    continue;
+                VarSymbol* param = boost::get<VarSymbol*>(call->proc_symbol->params[i]);
+                store(param, type);
+                if (annotating)
+                    call->integer_checks[i] = param->is_integer() && type != INT_TYPE;
+            }
+            break;
+        }
+        case 18:
+        {
+            //the input may be either, an INTEGER variable rejects REAL input
+            Var* target = boost::get<Var*>(boost::get<Read*>(node)->var);
+            store(target->symbol, UNKNOWN_TYPE);
+            if (annotating)
+                type_of(target);
+            break;
+        }
+        case 19:
+        {
+            Condition* condition = boost::get<Condition*>(node);
+            type_of(condition->condition_node);
+            for (auto statement : condition->if_statements)
+                visit(statement);
+            for (auto statement : condition->else_statements)
+                visit(statement);
+            break;
+        }
+        case 20:
+        {
+            Loop* loop = boost::get<Loop*>(node);
+            type_of(loop->condition_node);
+            for (auto statement : loop->statements)
+                visit(statement);
+            break;
+        }
+        }
+    }
+};
 
 class SemanticAnalyzer {
 
 public:
-    ScopedSymbolTable current_scope = ScopedSymbolTable("", 0);
+    Arena* arena; //symbols live as long as the program's nodes
+    ScopedSymbolTable* current_scope;
+    int scopes;         //scopes analyzed, the global one included
+    int symbols;        //variables, parameters and procedures declared in them
+    int largest_scope;  //most symbols declared in one scope
+
+    SemanticAnalyzer(Arena* arena)
+    {
+        this->arena = arena;
+        this->current_scope = builtin_scope();
+        this->scopes = this->symbols = this->largest_scope = 0;
+    }
 
-    void error(string error_code)
+    [[noreturn]] void error(string error_code)
     {
-        cout << "ERROR:: " << error_code << endl;
-        _Exit(10);
+        fail(error_code);
     }
 
     void visit(boostvar node)
@@ -218,7 +435,7 @@ public:
         visit(node->right);
     }
 
-    void visit_Num(Num* node)
+    void visit_Num(Num*)
     {
         return;
     }
@@ -234,7 +451,7 @@ public:
             visit(child);
     }
 
-    void visit_NoOp(NoOp* node)
+    void visit_NoOp(NoOp*)
     {
         return;
     }
@@ -242,23 +459,22 @@ public:
     void visit_Assign(Assign* node) {
         visit(node->left);
         visit(node->right);
+        Var* target = boost::get<Var*>(node->left);
+        node->slot = target->slot;
         if (node->right.which() == 5)
         {
             string var_name_right = boost::get<Var*>(node->right)->value;
-            VarSymbol* var_sym_right = boost::get<VarSymbol*>(this->current_scope.lookup(var_name_right));
+            VarSymbol* var_sym_right = boost::get<VarSymbol*>(this->current_scope->lookup(var_name_right));
             string var_name_left = boost::get<Var*>(node->left)->value;
-            VarSymbol* var_sym_left = boost::get<VarSymbol*>(this->current_scope.lookup(var_name_left));
+            VarSymbol* var_sym_left = boost::get<VarSymbol*>(this->current_scope->lookup(var_name_left));
             BuiltinTypeSymbol* type_val_left = boost::get<BuiltinTypeSymbol*>(var_sym_left->type);
             BuiltinTypeSymbol* type_val_right = boost::get<BuiltinTypeSymbol*>(var_sym_right->type);
             if (type_val_left->name != type_val_right->name)
-            {
-                cout << "ERROR:: Incompatible types: " << var_name_right << " assignment to " << var_name_left << endl;
-                _Exit(10);
-            }
+                fail("Incompatible types: " + var_name_right + " assignment to " + var_name_left);
         }
     }
 
-    void visit_Message(Message* node)
+    void visit_Message(Message*)
     {
         return;
     }
@@ -266,6 +482,7 @@ public:
     void visit_Read(Read* node)
     {
         visit(node->var);
+        node->integer_target = boost::get<Var*>(node->var)->symbol->is_integer();
     }
 
     void visit_Print(Print* node)
@@ -277,49 +494,107 @@ public:
     void visit_Var(Var* node) 
     {
         string var_name = node->value;
-        boostvar var_symbol = current_scope.lookup(var_name);
+        boostvar var_symbol = current_scope->lookup(var_name);
+        if (var_symbol.which() != 12)
+            current_scope->error("Variable not found", var_name);
+
+        VarSymbol* symbol = boost::get<VarSymbol*>(var_symbol);
+        node->slot = symbol->slot;
+        node->depth = symbol->scope_level;
+        node->symbol = symbol;
     }
 
     void visit_ProcedureDecl(ProcedureDecl* node) 
     {
         string proc_name = node->proc_name;
-        ProcedureSymbol* proc_symbol = new ProcedureSymbol(proc_name, vector<boostvar>());
+        ProcedureSymbol* proc_symbol = arena->make<ProcedureSymbol>(proc_name, vector<boostvar>());
         proc_symbol->block_node = node->block_node;
+        proc_symbol->inherited = this->current_scope->frame_size;
+        node->proc_symbol = proc_symbol;
 
-        this->current_scope.insert(proc_symbol);
-        enclosed_scopes.push(current_scope);
+        this->current_scope->insert(proc_symbol);
         //cout << "Enter scope: " << proc_name << endl;
 
-        ScopedSymbolTable procedure_scope = ScopedSymbolTable(proc_name, this->current_scope.scope_level + 1);
-        this->current_scope = procedure_scope;
+        ScopedSymbolTable* enclosing_scope = this->current_scope;
+        ScopedSymbolTable procedure_scope(proc_name, enclosing_scope->scope_level + 1, enclosing_scope, enclosing_scope->frame_size);
+        this->current_scope = &procedure_scope;
 
         for (auto param : node->params) 
         {
             Param* param_node = boost::get<Param*>(param);
             Type* type_node = boost::get<Type*>(param_node->type_node);
-            boostvar param_type = this->current_scope.lookup(type_node->value);
+            boostvar param_type = this->current_scope->lookup(type_node->value);
 
             Var* var_node = boost::get<Var*>(param_node->var_node);
             string param_name = var_node->value;
 
-            VarSymbol* var_symbol = new VarSymbol(param_name, param_type);
-            this->current_scope.insert(var_symbol);
+            VarSymbol* var_symbol = arena->make<VarSymbol>(param_name, param_type);
+            var_symbol->slot = this->current_scope->allocate_slot();
+            this->current_scope->insert(var_symbol);
+            var_node->slot = var_symbol->slot;
+            var_node->depth = var_symbol->scope_level;
 
             proc_symbol->params.push_back(var_symbol);
         }
         visit(node->block_node);
+        proc_symbol->frame_size = this->current_scope->frame_size;
+        mark_tail_call(boost::get<Block*>(node->block_node)->compound_statement, this->current_scope->scope_level);
         //cout << "procedure_scope" << endl;
 
-        this->current_scope = enclosed_scopes.top();
-        enclosed_scopes.pop();
+        close_scope(procedure_scope);
+        this->current_scope = enclosing_scope;
 
         //cout << "Leave scope : " << proc_name << endl;
     }
 
+    void close_scope(ScopedSymbolTable& scope)
+    {
+        scopes++;
+        symbols += scope.symbols.size();
+        largest_scope = max(largest_scope, (int)scope.symbols.size());
+    }
+
+    /*
+       A call is in tail position when nothing of its procedure runs after it: it ends the
+       body, or ends a branch of an IF that ends the body. Its frame can then be replaced by
+       the callee's, unless the callee is nested inside the procedure and needs the frame as
+       its enclosing scope.
+    */
+    void mark_tail_call(boostvar statement, int level)
+    {
+        if (statement.which() == 3)
+            mark_last_statement(boost::get<Compound*>(statement)->children, level);
+        else if (statement.which() == 19)
+        {
+            Condition* condition = boost::get<Condition*>(statement);
+            mark_last_statement(condition->if_statements, level);
+            mark_last_statement(condition->else_statements, level);
+        }
+        else if (statement.which() == 17)
+        {
+            ProcedureCall* call = boost::get<ProcedureCall*>(statement);
+            ProcedureSymbol* callee = call->proc_symbol;
+            if (callee && callee->scope_level + 1 <= level && callee->params.size() == call->actual_params.size())
+                call->tail_call = true;
+        }
+    }
+
+    void mark_last_statement(vector<boostvar>& statements, int level)
+    {
+        for (int i = statements.size() - 1; i >= 0; i--)
+        {
+            if (statements[i].which() != 6)
+            {
+                mark_tail_call(statements[i], level);
+                return;
+            }
+        }
+    }
+
     void visit_ProcedureCall(ProcedureCall* node)
     {
         string proc_name = node->proc_name;
-        boostvar proc = current_scope.lookup(proc_name, true);
+        boostvar proc = current_scope->lookup(proc_name, true);
        
         if (proc.which() == 15)
         {
@@ -336,17 +611,21 @@ public:
         Type* type_node = boost::get<Type*>(node->type_node);
         string type_name = type_node->value;
 
-        boostvar type_symbol = current_scope.lookup(type_name);
+        boostvar type_symbol = current_scope->lookup(type_name);
         Var* var_node = boost::get<Var*>(node->var_node);
         string var_name = var_node->value;
 
-        if (current_scope.symbols.find(var_name) != current_scope.symbols.end()) 
+        if (current_scope->symbols.find(var_name) != current_scope->symbols.end()) 
         {
-            cout << "ERROR:: Duplicate variable found -> " << var_node->token <<endl;
-            _Exit(10);
+            ostringstream message;
+            message << "Duplicate variable found -> " << var_node->token;
+            fail(message.str());
         }
-        boostvar var_symbol = new VarSymbol(var_name, type_symbol);
-        current_scope.insert(var_symbol);
+        VarSymbol* var_symbol = arena->make<VarSymbol>(var_name, type_symbol);
+        var_symbol->slot = current_scope->allocate_slot();
+        current_scope->insert(var_symbol);
+        var_node->slot = var_symbol->slot;
+        var_node->depth = var_symbol->scope_level;
     }
 
     void visit_Condition(Condition* node)
@@ -375,13 +654,15 @@ public:
     void visit_Program(Program* node)
     {
         //cout << "Enter Scope : GLOBAL" << endl;
-        ScopedSymbolTable global_scope = ScopedSymbolTable("GLOBAL", 1);
-        enclosed_scopes.push(current_scope);
-        this->current_scope = global_scope;
+        ScopedSymbolTable* enclosing_scope = this->current_scope;
+        ScopedSymbolTable global_scope("GLOBAL", 1, enclosing_scope);
+        this->current_scope = &global_scope;
         visit(node->block);
+        node->frame_size = this->current_scope->frame_size;
+        TypeInference().infer(node);
         //cout << "global_scope" << endl;
-        this->current_scope = enclosed_scopes.top();
-        enclosed_scopes.pop();
+        close_scope(global_scope);
+        this->current_scope = enclosing_scope;
         //cout << "Leave scope : GLOBAL" << endl;
     }
 };
@@ -0,0 +1,590 @@
+#pragma once
+#include "interpreter.h"
+#include <vector>
+
+/* ###############################
+   #     BYTECODE COMPILER       #
+   ###############################
+*/
+
+enum OpCode : unsigned char
+{
+    OP_CONST,           //push constants[operand]
+    OP_LOAD,            //push slot operand of the current frame
+    OP_STORE,           //pop into slot operand
+    OP_STORE_INTEGER,   //pop into slot operand, rejecting REAL values
+    OP_LOAD_OUTER,      //push slot operand of the display frame at level
+    OP_STORE_OUTER,     //pop into slot operand of the display frame at level
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_INTEGER_DIV,
+    OP_FLOAT_DIV,
+    OP_POW,
+    OP_NEG,
+    OP_LOAD_CACHED,     //push slot operand if it holds a value, otherwise skip the next instruction
+    OP_CACHE,           //copy the top of the stack into slot operand
+    OP_INVALIDATE,      //forget the value of slot operand
+    OP_JUMP,            //ip = operand
+    OP_LOOP,            //ip = operand, back to the condition of a WHILE loop
+    OP_JUMP_IF_FALSE,   //pop, ip = operand when the value is not truthy
+    OP_CHECK_INTEGER,   //top of stack must not be REAL, operand names the parameter
+    OP_ARITY_ERROR,     //operand 0 -> too few, 1 -> too many arguments
+    OP_CALL,            //call procedures[operand], arguments are on the stack
+    OP_TAIL_CALL,       //like OP_CALL, but the callee's frame replaces the current one
+    OP_RETURN,
+    OP_READ,            //push a number read from the input
+    OP_PRINT,           //pop and print one message
+    OP_PRINT_END,       //finish the PRINT statement
+    OP_HALT
+};
+
+struct Instruction
+{
+    OpCode op;
+    unsigned char level;    //scope level of the frame for OP_LOAD_OUTER and OP_STORE_OUTER
+    int operand;
+};
+
+class CodeObject : public FrameLayout
+{
+
+public:
+    vector<Instruction> code;
+    const Instruction* instructions;    //what the VM runs: code.data(), or the code of a cached program where it is mapped
+    size_t instruction_count;
+
+    CodeObject(string name, int level, int inherited, int frame_size, FrameLayout* enclosing = NULL)
+        : FrameLayout(name, level, inherited, frame_size, enclosing)
+    {
+        this->instructions = NULL;
+        this->instruction_count = 0;
+    }
+};
+
+class BytecodeProgram
+{
+
+public:
+    vector<CodeObject*> procedures;  //procedures[0] is the main program
+    vector<Value> constants;
+    vector<string> names;            //parameter names for OP_CHECK_INTEGER
+
+    BytecodeProgram() = default;
+    BytecodeProgram(const BytecodeProgram&) = delete;
+    BytecodeProgram& operator=(const BytecodeProgram&) = delete;
+
+    ~BytecodeProgram()
+    {
+        for (CodeObject* code : procedures)
+            delete code;
+    }
+};
+
+//Lowers an analysed AST into bytecode
+class BytecodeCompiler
+{
+    BytecodeProgram* program;
+    vector<CodeObject*> code_stack;
+    unordered_map<Block*, int> procedure_index;
+
+public:
+    BytecodeCompiler()
+    {
+        this->program = NULL;
+    }
+
+    [[noreturn]] void error(string error_code)
+    {
+        fail(error_code);
+    }
+
+    BytecodeProgram* compile(boostvar tree)
+    {
+        program = new BytecodeProgram();
+        Program* program_node = boost::get<Program*>(tree);
+        CodeObject* main_code = new CodeObject(program_node->name, 1, 0, program_node->frame_size);
+        program->procedures.push_back(main_code);
+
+        code_stack.push_back(main_code);
+        compile_block(boost::get<Block*>(program_node->block));
+        emit(OP_HALT);
+        code_stack.pop_back();
+        for (CodeObject* code : program->procedures)
+        {
+            code->instructions = code->code.data();
+            code->instruction_count = code->code.size();
+        }
+        return program;
+    }
+
+private:
+    CodeObject* code()
+    {
+        return code_stack.back();
+    }
+
+    int emit(OpCode op, int operand = 0, int level = 0)
+    {
+        code()->code.push_back({ op, (unsigned char)level, operand });
+        return code()->code.size() - 1;
+    }
+
+    void patch(int at)
+    {
+        code()->code[at].operand = code()->code.size();
+    }
+
+    int add_constant(Value value)
+    {
+        program->constants.push_back(value);
+        return program->constants.size() - 1;
+    }
+
+    void compile_block(Block* node)
+    {
+        for (auto declaration : node->declarations)
+        {
+            if (declaration.which() == 9)
+                code()->declare(boost::get<Var*>(boost::get<VarDecl*>(declaration)->var_node));
+            else if (declaration.which() == 13)
+                compile_procedure(boost::get<ProcedureDecl*>(declaration));
+        }
+        compile_statement(node->compound_statement);
+    }
+
+    void compile_procedure(ProcedureDecl* node)
+    {
+        ProcedureSymbol* proc_symbol = node->proc_symbol;
+        CodeObject* proc_code = new CodeObject(node->proc_name, proc_symbol->scope_level + 1, proc_symbol->inherited, proc_symbol->frame_size, code());
+        procedure_index[boost::get<Block*>(node->block_node)] = program->procedures.size();
+        program->procedures.push_back(proc_code);
+
+        code_stack.push_back(proc_code);
+        for (auto param : node->params)
+            proc_code->declare_param(boost::get<Var*>(boost::get<Param*>(param)->var_node));
+        compile_block(boost::get<Block*>(node->block_node));
+        emit(OP_RETURN);
+        code_stack.pop_back();
+    }
+
+    void compile_statements(vector<boostvar>& statements)
+    {
+        for (auto statement : statements)
+            compile_statement(statement);
+    }
+
+    void compile_statement(boostvar node)
+    {
+        switch (node.which())
+        {
+        case 3:
+            compile_statements(boost::get<Compound*>(node)->children);
+            break;
+        case 4:
+            compile_assign(boost::get<Assign*>(node));
+            break;
+        case 6:
+            break;
+        case 16:
+            compile_print(boost::get<Print*>(node));
+            break;
+        case 17:
+            compile_call(boost::get<ProcedureCall*>(node));
+            break;
+        case 18:
+        {
+            Read* read = boost::get<Read*>(node);
+            emit(OP_READ);
+            compile_store(boost::get<Var*>(read->var), read->integer_target);
+            break;
+        }
+        case 19:
+            compile_condition(boost::get<Condition*>(node));
+            break;
+        case 20:
+            compile_loop(boost::get<Loop*>(node));
+            break;
+        default:
+            error("INVALID PARSING METHOD");
+        }
+    }
+
+    void compile_store(Var* variable, bool integer_target)
+    {
+        if (variable->depth == code()->level)
+        {
+            emit(integer_target ? OP_STORE_INTEGER : OP_STORE, variable->slot);
+            return;
+        }
+        if (integer_target)
+        {
+            program->names.push_back(variable->value);
+            emit(OP_CHECK_INTEGER, program->names.size() - 1);
+        }
+        emit(OP_STORE_OUTER, variable->slot, variable->depth);
+    }
+
+    void compile_assign(Assign* node)
+    {
+        compile_expression(node->right);
+        compile_store(boost::get<Var*>(node->left), node->integer_target);
+    }
+
+    void compile_print(Print* node)
+    {
+        for (auto message : node->messages)
+        {
+            compile_expression(message);
+            emit(OP_PRINT);
+        }
+        emit(OP_PRINT_END);
+    }
+
+    void compile_call(ProcedureCall* node)
+    {
+        ProcedureSymbol* proc_symbol = node->proc_symbol;
+        int index = procedure_index[boost::get<Block*>(proc_symbol->block_node)];
+
+        if (proc_symbol->params.size() != node->actual_params.size())
+        {
+            emit(OP_ARITY_ERROR, proc_symbol->params.size() > node->actual_params.size() ? 0 : 1);
+            return;
+        }
+
+        for (size_t i = 0; i < node->actual_params.size(); i++)
+        {
+            compile_expression(node->actual_params[i]);
+            VarSymbol* var = boost::get<VarSymbol*>(proc_symbol->params[i]);
+            if (node->integer_checks[i])
+            {
+                program->names.push_back(var->name);
+                emit(OP_CHECK_INTEGER, program->names.size() - 1);
+            }
+        }
+        emit(node->tail_call ? OP_TAIL_CALL : OP_CALL, index);
+    }
+
+    void compile_condition(Condition* node)
+    {
+        compile_expression(node->condition_node);
+        int to_else = emit(OP_JUMP_IF_FALSE);
+        compile_statements(node->if_statements);
+        int to_end = emit(OP_JUMP);
+        patch(to_else);
+        compile_statements(node->else_statements);
+        patch(to_end);
+    }
+
+    void compile_loop(Loop* node)
+    {
+        for (int slot : node->invariant_slots)
+            emit(OP_INVALIDATE, slot);
+        int start = code()->code.size();
+        compile_expression(node->condition_node);
+        int to_end = emit(OP_JUMP_IF_FALSE);
+        compile_statements(node->statements);
+        emit(OP_LOOP, start);
+        patch(to_end);
+    }
+
+    void compile_expression(boostvar node)
+    {
+        if (node.which() == 0)
+        {
+            BinOp* bin_op = boost::get<BinOp*>(node);
+            compile_expression(bin_op->left);
+            compile_expression(bin_op->right);
+            switch (bin_op->op.type)
+            {
+            case PLUS: emit(OP_ADD); break;
+            case MINUS: emit(OP_SUB); break;
+            case MUL: emit(OP_MUL); break;
+            case INTEGER_DIV: emit(OP_INTEGER_DIV); break;
+            case FLOAT_DIV: emit(OP_FLOAT_DIV); break;
+            default: emit(OP_POW);
+            }
+        }
+        else if (node.which() == 1)
+        {
+            emit(OP_CONST, add_constant(boost::get<Num*>(node)->constant));
+        }
+        else if (node.which() == 2)
+        {
+            UnaryOp* unary_op = boost::get<UnaryOp*>(node);
+            compile_expression(unary_op->expr);
+            if (unary_op->op.type == MINUS)
+                emit(OP_NEG);
+        }
+        else if (node.which() == 5)
+        {
+            Var* variable = boost::get<Var*>(node);
+            if (variable->depth == code()->level)
+                emit(OP_LOAD, variable->slot);
+            else
+                emit(OP_LOAD_OUTER, variable->slot, variable->depth);
+        }
+        else if (node.which() == 21)
+            emit(OP_CONST, add_constant(Value(&boost::get<Message*>(node)->msg)));
+        else if (node.which() == 22)
+        {
+            Invariant* invariant = boost::get<Invariant*>(node);
+            emit(OP_LOAD_CACHED, invariant->slot);
+            int to_end = emit(OP_JUMP);
+            compile_expression(invariant->expr);
+            emit(OP_CACHE, invariant->slot);
+            patch(to_end);
+        }
+        else
+            error("INVALID PARSING METHOD");
+    }
+};
+
+/* ###############################
+   #     VIRTUAL MACHINE         #
+   ###############################
+*/
+
+class VM
+{
+    struct Frame
+    {
+        CodeObject* code;
+        int ip;
+        int base;
+    };
+
+    BytecodeProgram* program;
+    RunContext* context;
+    vector<Value> stack;
+    FrameStack variables;
+    vector<Frame> frames;
+
+public:
+    VM(BytecodeProgram* program, RunContext* context, int max_depth = DEFAULT_MAX_DEPTH)
+    {
+        this->program = program;
+        this->context = context;
+        this->variables.max_depth = max_depth;
+    }
+
+    [[noreturn]] void error(string message)
+    {
+        fail(message);
+    }
+
+    FrameStack& frame_stack()
+    {
+        return variables;
+    }
+
+    Value run()
+    {
+        CodeObject* main_code = program->procedures[0];
+        frames.push_back({ main_code, 0, variables.enter_program(main_code) });
+        execute();
+        return 0;
+    }
+
+private:
+    Value pop()
+    {
+        Value value = stack.back();
+        stack.pop_back();
+        return value;
+    }
+
+    void call(CodeObject* callee)
+    {
+        int first_arg = stack.size() - callee->param_slots.size();
+        int base = variables.enter(callee, stack.data() + first_arg);
+        stack.resize(first_arg);
+        frames.push_back({ callee, 0, base });
+    }
+
+    void execute()
+    {
+        Frame* frame = &frames.back();
+        const Instruction* code = frame->code->instructions;
+        int ip = frame->ip;
+
+        while (true)
+        {
+            const Instruction& instruction = code[ip++];
+            switch (instruction.op)
+            {
+            case OP_CONST:
+                stack.push_back(program->constants[instruction.operand]);
+                break;
+
+            case OP_LOAD:
+                stack.push_back(variables.load(frame->code, frame->base, instruction.operand));
+                break;
+
+            case OP_STORE_INTEGER:
+                if (stack.back().which() == 1)
+                    error("Incompatible type: variable '" + frame->code->slot_name(instruction.operand) + "'");
+                //fall through
+            case OP_STORE:
+                variables.store(frame->base, instruction.operand, pop());
+                break;
+
+            case OP_LOAD_OUTER:
+                stack.push_back(variables.load(frame->code, variables.display[instruction.level], instruction.operand));
+                break;
+
+            case OP_STORE_OUTER:
+                variables.store(variables.display[instruction.level], instruction.operand, pop());
+                break;
+
+            case OP_ADD:
+            {
+                Value& left = stack[stack.size() - 2];
+                Value& right = stack.back();
+                if (left.which() == 0 && right.which() == 0)
+                    left.as_int() = left.as_int() + right.as_int();
+                else
+                    left = add_values(left, right);
+                stack.pop_back();
+                break;
+            }
+
+            case OP_SUB:
+            {
+                Value& left = stack[stack.size() - 2];
+                Value& right = stack.back();
+                if (left.which() == 0 && right.which() == 0)
+                    left.as_int() = left.as_int() - right.as_int();
+                else
+                    left = subtract_values(left, right);
+                stack.pop_back();
+                break;
+            }
+
+            case OP_MUL:
+            {
+                Value& left = stack[stack.size() - 2];
+                Value& right = stack.back();
+                if (left.which() == 0 && right.which() == 0)
+                    left.as_int() = left.as_int() * right.as_int();
+                else
+                    left = multiply_values(left, right);
+                stack.pop_back();
+                break;
+            }
+
+            case OP_INTEGER_DIV:
+            {
+                Value& left = stack[stack.size() - 2];
+                left = integer_divide_values(left, stack.back());
+                stack.pop_back();
+                break;
+            }
+
+            case OP_FLOAT_DIV:
+            {
+                Value& left = stack[stack.size() - 2];
+                left = float_divide_values(left, stack.back());
+                stack.pop_back();
+                break;
+            }
+
+            case OP_POW:
+            {
+                Value& left = stack[stack.size() - 2];
+                left = power_values(left, stack.back());
+                stack.pop_back();
+                break;
+            }
+
+            case OP_NEG:
+                stack.back() = negate_value(stack.back());
+                break;
+
+            case OP_LOAD_CACHED:
+                if (variables.assigned[frame->base + instruction.operand])
+                    stack.push_back(variables.slots[frame->base + instruction.operand]);
+                else
+                    ip++;
+                break;
+
+            case OP_CACHE:
+                variables.store(frame->base, instruction.operand, stack.back());
+                break;
+
+            case OP_INVALIDATE:
+                variables.invalidate(frame->base, instruction.operand);
+                break;
+
+            case OP_JUMP:
+                ip = instruction.operand;
+                break;
+
+            case OP_LOOP:
+                variables.loop_iterations++;
+                ip = instruction.operand;
+                break;
+
+            case OP_JUMP_IF_FALSE:
+                if (!is_truthy(stack.back()))
+                    ip = instruction.operand;
+                stack.pop_back();
+                break;
+
+            case OP_CHECK_INTEGER:
+                if (stack.back().which() == 1)
+                    error("Incompatible type: variable '" + program->names[instruction.operand] + "'");
+                break;
+
+            case OP_ARITY_ERROR:
+                if (instruction.operand == 0)
+                    error("Too few arguments given in the function call.");
+                else
+                    error("Too many arguments given in the function call.");
+                break;
+
+            case OP_CALL:
+                frame->ip = ip;
+                call(program->procedures[instruction.operand]);
+                frame = &frames.back();
+                code = frame->code->instructions;
+                ip = 0;
+                break;
+
+            case OP_TAIL_CALL:
+                variables.leave();
+                frames.pop_back();
+                call(program->procedures[instruction.operand]);
+                frame = &frames.back();
+                code = frame->code->instructions;
+                ip = 0;
+                break;
+
+            case OP_RETURN:
+                variables.leave();
+                frames.pop_back();
+                frame = &frames.back();
+                code = frame->code->instructions;
+                ip = frame->ip;
+                break;
+
+            case OP_READ:
+                stack.push_back(context->input.read_value());
+                break;
+
+            case OP_PRINT:
+                context->output.print_value(stack.back());
+                stack.pop_back();
+                break;
+
+            case OP_PRINT_END:
+                context->output.print_end();
+                break;
+
+            case OP_HALT:
+                frames.pop_back();
+                return;
+            }
+        }
+    }
+};